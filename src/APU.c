@@ -16,10 +16,14 @@
 #include "Nes.h"
 #include "Utils.h"
 #include "Common.h"
+#include "BlipBuffer.c"
 
 
 #define COUNTER_STOP 0xFFFF
 #define MAX_VOLUME 15
+#define APU_MAX_UNREAD_CYCLES (1 << 15)
+#define APU_MAX_SAMPLES_PER_READ 4096
+#define APU_NO_DMC_FETCH UINT64_MAX
 
 
 typedef struct Sweeper 
@@ -51,7 +55,9 @@ typedef struct Envelope
 
 typedef struct Sequencer 
 {
-    double DutyCyclePercentage;
+    u8 Duty;
+    u8 Step;
+    u16 Timer;
     u16 TmpTimerPeriod;
     u16 TimerPeriod;
 
@@ -69,6 +75,8 @@ typedef struct TriangleSequencer
     Bool8 EnableFlag;
     u8 TmpLinearCounter;
     u8 LinearCounter;
+    u8 Step;
+    u16 Timer;
     u16 TmpTimerPeriod;
     u16 TimerPeriod;
 } TriangleSequencer;
@@ -84,6 +92,32 @@ typedef struct NoiseSequencer
     Envelope Envelope;
 } NoiseSequencer;
 
+/* delta modulation channel: plays 1 bit deltas fetched from cpu memory a byte at a time, 
+ * the APU doesn't fetch the bytes itself, whoever owns the bus does (see NESAPU_NextDMCFetch) */
+typedef struct DMCChannel 
+{
+    Bool8 IRQEnableFlag;
+    Bool8 LoopFlag;
+    Bool8 IRQFlag;
+    Bool8 SilenceFlag;
+    Bool8 BufferEmpty;
+
+    u16 Timer;
+    u16 TimerPeriod;
+
+    /* memory reader */
+    u16 SampleAddr;
+    u16 SampleLength;
+    u16 CurrentAddr;
+    u16 BytesRemaining;
+    u8 Buffer;
+
+    /* output unit */
+    u8 ShiftRegister;
+    u8 BitsRemaining;
+    u8 Output;          /* 0 to 127 */
+} DMCChannel;
+
 
 typedef struct NESAPU 
 {
@@ -91,64 +125,55 @@ typedef struct NESAPU
     Sequencer Pulse2;
     TriangleSequencer Triangle;
     NoiseSequencer Noise;
+    DMCChannel DMC;
 
+    /* the APU is run lazily (see NESAPU_CatchUp), this is how many master clks it's been run for */
     u64 ClockCounter;
     u64 FrameClockCounter;
 
-    double AudioSample;
-    double ElapsedTime;
+    /* every change of Output goes into Blip as a step, BlipClock is in cpu cycles since the last NESAPU_ReadSample */
+    NESBlipBuffer Blip;
+    u32 BlipClock;
+    i32 Output;
+    i16 LastSample;
+
+    /* every channel on its own as well (see NESAPU_EnableStems), 
+     * the stems' blip buffers always have exactly as many samples as Blip */
+    Bool8 StemsEnabled;
+    i32 StemOutput[NES_AUDIO_STEM_COUNT];
+    i16 LastStemSample[NES_AUDIO_STEM_COUNT];
+    NESBlipBuffer StemBlips[NES_AUDIO_STEM_COUNT];
+
     u8 LengthCounterTable[0x20];
     u16 NTSCNoisePeriodTable[0x10];
+    u16 NTSCDMCPeriodTable[0x10];
 } NESAPU;
 
 
 
-void NESAPU_Reset(NESAPU *This)
-{
-    This->ElapsedTime = 0;
-    This->Pulse1    = (Sequencer) { 0 };
-    This->Pulse2    = (Sequencer) { 0 };
-    This->Triangle  = (TriangleSequencer) { 0 };
-    This->Noise     = (NoiseSequencer) { 
-        .LinearFeedbackShiftRegister = 1 
-    };
-}
+/* sound mixer, a bunch of magic, consult APU mixer section of nesdev for details 
+ * (the channels don't mix linearly, so it's a lookup on the sum of the channels' levels),
+ * in int16 units, everything at full volume swings across the whole int16 range */
+static i32 sAPUPulseTable[31];     /* pulse1 + pulse2 */
+static i32 sAPUTNDTable[203];      /* 3*triangle + 2*noise + dmc */
+static Bool8 sAPUMixerTablesInitialized = false;
 
-NESAPU NESAPU_Init(u64 SeedForNoiseGeneration)
+static void NESAPU_InitMixerTables(void)
 {
-    NESAPU APU = {
-        /* https://www.nesdev.org/wiki/APU_Length_Counter */
-        .LengthCounterTable = {
-            10, 254, 20,  2, 40,  4, 80,  6, 160,  8, 60, 10, 14, 12, 26, 14, 
-            12,  16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30
-        },
-        .NTSCNoisePeriodTable = {
-            4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068
-        },
-    };
-    NESAPU_Reset(&APU);
-    return APU;
-}
-
-
-
-
-/* sample generator */
+    if (sAPUMixerTablesInitialized)
+        return;
 
-static double GenerateSquareWave(Sequencer *Seq, double t)
-{
-    /* 16.0: nameless magic, consult nesdev */
-    double Freq = NES_CPU_CLK / (16.0 * (double)(Seq->TimerPeriod + 1));
-    t *= Freq;
-    double FractionalPart = t - (i64)t;
-    return FractionalPart < Seq->DutyCyclePercentage? 
-        1.0 : -1.0;
+    /* 0 is silence in both, which the formulas would divide by */
+    static const double Scale = 2.0 * INT16_MAX;
+    for (uint i = 1; i < STATIC_ARRAY_SIZE(sAPUPulseTable); i++)
+        sAPUPulseTable[i] = (i32)(Scale * 95.52 / (8128.0 / i + 100) + .5);
+    for (uint i = 1; i < STATIC_ARRAY_SIZE(sAPUTNDTable); i++)
+        sAPUTNDTable[i] = (i32)(Scale * 163.67 / (24329.0 / i + 100) + .5);
+    sAPUMixerTablesInitialized = true;
 }
 
 
 
-
-
 /* square wave sequencer */
 
 static void NESAPU_EnvelopeUpdate(Envelope *VolumeCtrl)
@@ -187,14 +212,40 @@ static void NESAPU_EnvelopeUpdate(Envelope *VolumeCtrl)
     }
 }
 
-static double NESAPU_SequencerGetVolume(Sweeper *PitchCtrl, const Envelope *VolumeCtrl)
+static u8 NESAPU_SequencerGetVolume(const Sweeper *PitchCtrl, const Envelope *VolumeCtrl)
 {
     if (PitchCtrl->MutingFlag || 0 == VolumeCtrl->LengthCounter)
         return 0;
 
     if (VolumeCtrl->ConstantVolumeFlag)
-        return (double)VolumeCtrl->Volume * (1.0 / MAX_VOLUME);
-    return (double)VolumeCtrl->VolumeDecayCounter * (1.0 / MAX_VOLUME);
+        return VolumeCtrl->Volume;
+    return VolumeCtrl->VolumeDecayCounter;
+}
+
+/* clocked every other cpu cycle, returns whether the output could have changed */
+static Bool8 NESAPU_PulseStepTimer(Sequencer *Seq)
+{
+    if (Seq->Timer)
+    {
+        Seq->Timer--;
+        return false;
+    }
+    Seq->Timer = Seq->TimerPeriod;
+    Seq->Step = (Seq->Step - 1) & 0x7; /* the sequencer counts down */
+    return true;
+}
+
+static u8 NESAPU_GetPulseOutput(const Sequencer *Seq)
+{
+    static const u8 DutySequences[4][8] = {
+        { 0, 1, 0, 0, 0, 0, 0, 0 },
+        { 0, 1, 1, 0, 0, 0, 0, 0 },
+        { 0, 1, 1, 1, 1, 0, 0, 0 },
+        { 1, 0, 0, 1, 1, 1, 1, 1 },
+    };
+    if (!DutySequences[Seq->Duty][Seq->Step])
+        return 0;
+    return NESAPU_SequencerGetVolume(&Seq->Sweeper, &Seq->Envelope);
 }
 
 
@@ -218,18 +269,32 @@ static void NESAPU_TriangleSequencerUpdate(TriangleSequencer *Seq)
     }
 }
 
-static double NESAPU_GetTriangleSample(TriangleSequencer *Seq, double t)
+/* clocked every cpu cycle, returns whether the output changed */
+static Bool8 NESAPU_TriangleStepTimer(TriangleSequencer *Seq)
 {
-    if (!Seq->LinearCounter || !Seq->EnableFlag)
-        return 0;
+    if (Seq->Timer)
+    {
+        Seq->Timer--;
+        return false;
+    }
+    Seq->Timer = Seq->TimerPeriod;
+
+    /* the sequencer just stops (and keeps outputting the same level) when silenced, 
+     * the ultrasonic periods are silenced too, they'd only come out as a DC offset on a real TV anyway */
+    if (!Seq->LinearCounter || !Seq->EnableFlag || Seq->TimerPeriod < 2)
+        return false;
+    Seq->Step = (Seq->Step + 1) & 0x1F;
+    return true;
+}
 
-    /* another nameless magic, please for the love of god consult APU Triangle sequencer in nesdev wiki */
-    double Freq = NES_CPU_CLK / (32.0 * (double)(Seq->TimerPeriod + 1));
-    t *= Freq;
-    t -= (i64)t;
-    if (t < .5)
-        return 2.0*t;
-    return 2.0*(-t + 1.0);
+static u8 NESAPU_GetTriangleOutput(const TriangleSequencer *Seq)
+{
+    /* please for the love of god consult APU Triangle sequencer in nesdev wiki */
+    static const u8 TriangleSequence[32] = {
+        15, 14, 13, 12, 11, 10,  9,  8,  7,  6,  5,  4,  3,  2,  1,  0,
+         0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+    };
+    return TriangleSequence[Seq->Step];
 }
 
 
@@ -280,24 +345,24 @@ static u16 NESAPU_SweeperUpdateTimerPeriod(Sweeper *PitchCtrl, u16 CurrentTimerP
 
 /* noise */
 
-static double NESAPU_GetNoiseSample(NoiseSequencer *Noise)
+static u8 NESAPU_GetNoiseVolume(const NoiseSequencer *Noise)
 {
-    if ((Noise->LinearFeedbackShiftRegister & 0x1) || Noise->Envelope.LengthCounter == 0 || !Noise->Envelope.EnableFlag)
+    if (Noise->Envelope.LengthCounter == 0 || !Noise->Envelope.EnableFlag)
         return 0;
     if (Noise->Envelope.ConstantVolumeFlag)
-        return Noise->Envelope.Volume * (1.0 / MAX_VOLUME);
-    return (double)Noise->Envelope.VolumeDecayCounter * (1.0 / MAX_VOLUME);
+        return Noise->Envelope.Volume;
+    return Noise->Envelope.VolumeDecayCounter;
 }
 
-static void NESAPU_NoiseUpdateShiftRegister(NoiseSequencer *Noise)
+static u8 NESAPU_GetNoiseOutput(const NoiseSequencer *Noise)
 {
-    if (Noise->Timer)
-    {
-        Noise->Timer--;
-        return;
-    }
+    if (Noise->LinearFeedbackShiftRegister & 0x1)
+        return 0;
+    return NESAPU_GetNoiseVolume(Noise);
+}
 
-    Noise->Timer = Noise->TmpTimer;
+static void NESAPU_NoiseShift(NoiseSequencer *Noise)
+{
     u16 TheOtherBit = Noise->ModeFlag
         ? Noise->LinearFeedbackShiftRegister >> 6 
         : Noise->LinearFeedbackShiftRegister >> 1; 
@@ -308,21 +373,160 @@ static void NESAPU_NoiseUpdateShiftRegister(NoiseSequencer *Noise)
     Noise->LinearFeedbackShiftRegister |= Feedback << 14;
 }
 
+/* clocked every cpu cycle, returns whether the output could have changed */
+static Bool8 NESAPU_NoiseUpdateShiftRegister(NoiseSequencer *Noise)
+{
+    if (Noise->Timer)
+    {
+        Noise->Timer--;
+        return false;
+    }
+
+    Noise->Timer = Noise->TmpTimer;
+    NESAPU_NoiseShift(Noise);
+    return true;
+}
+
+
+
+
+
+
+/* delta modulation channel */
+
+/* clocked every cpu cycle, returns whether the output changed */
+static Bool8 NESAPU_DMCStepTimer(DMCChannel *DMC)
+{
+    if (DMC->Timer)
+    {
+        DMC->Timer--;
+        return false;
+    }
+    DMC->Timer = DMC->TimerPeriod;
+
+    /* 1 goes up by 2, 0 goes down by 2, unless that would go out of 0..127 */
+    Bool8 OutputChanged = false;
+    if (!DMC->SilenceFlag)
+    {
+        if (DMC->ShiftRegister & 1)
+        {
+            if (DMC->Output <= 125)
+            {
+                DMC->Output += 2;
+                OutputChanged = true;
+            }
+        }
+        else if (DMC->Output >= 2)
+        {
+            DMC->Output -= 2;
+            OutputChanged = true;
+        }
+    }
+    DMC->ShiftRegister >>= 1;
+
+    /* next byte, this is where the buffer empties out and the memory reader wants another one */
+    if (--DMC->BitsRemaining == 0)
+    {
+        DMC->BitsRemaining = 8;
+        DMC->SilenceFlag = DMC->BufferEmpty;
+        if (!DMC->BufferEmpty)
+        {
+            DMC->ShiftRegister = DMC->Buffer;
+            DMC->BufferEmpty = true;
+        }
+    }
+    return OutputChanged;
+}
+
+static void NESAPU_DMCRestart(DMCChannel *DMC)
+{
+    DMC->CurrentAddr = DMC->SampleAddr;
+    DMC->BytesRemaining = DMC->SampleLength;
+}
+
+
+
+
+/* mixes the channels, and puts the change (if any) into the blip buffer */
+static void NESAPU_UpdateOutput(NESAPU *This)
+{
+    u8 Pulse1 = NESAPU_GetPulseOutput(&This->Pulse1);
+    u8 Pulse2 = NESAPU_GetPulseOutput(&This->Pulse2);
+    u8 Triangle = NESAPU_GetTriangleOutput(&This->Triangle);
+    u8 Noise = NESAPU_GetNoiseOutput(&This->Noise);
+    u8 DMC = This->DMC.Output;
+    i32 Output = sAPUPulseTable[Pulse1 + Pulse2] + sAPUTNDTable[3*Triangle + 2*Noise + DMC];
+
+    if (Output != This->Output)
+    {
+        NESBlip_AddDelta(&This->Blip, This->BlipClock, Output - This->Output);
+        This->Output = Output;
+    }
 
+    if (This->StemsEnabled)
+    {
+        /* what each channel would sound like if the others were silent */
+        i32 Stems[NES_AUDIO_STEM_COUNT] = {
+            [NES_AUDIO_STEM_PULSE1] = sAPUPulseTable[Pulse1],
+            [NES_AUDIO_STEM_PULSE2] = sAPUPulseTable[Pulse2],
+            [NES_AUDIO_STEM_TRIANGLE] = sAPUTNDTable[3*Triangle],
+            [NES_AUDIO_STEM_NOISE] = sAPUTNDTable[2*Noise],
+            [NES_AUDIO_STEM_DMC] = sAPUTNDTable[DMC],
+        };
+        for (uint i = 0; i < NES_AUDIO_STEM_COUNT; i++)
+        {
+            if (Stems[i] != This->StemOutput[i])
+            {
+                NESBlip_AddDelta(&This->StemBlips[i], This->BlipClock, Stems[i] - This->StemOutput[i]);
+                This->StemOutput[i] = Stems[i];
+            }
+        }
+    }
+}
 
+/* the cpu cycles since the last call are done, their samples can be read out */
+static void NESAPU_EndBlipFrame(NESAPU *This)
+{
+    NESBlip_EndFrame(&This->Blip, This->BlipClock);
+    if (This->StemsEnabled)
+    {
+        for (uint i = 0; i < NES_AUDIO_STEM_COUNT; i++)
+            NESBlip_EndFrame(&This->StemBlips[i], This->BlipClock);
+    }
+    This->BlipClock = 0;
+}
 
+/* throws the oldest Count samples away */
+static void NESAPU_DiscardSamples(NESAPU *This, uint Count)
+{
+    NESBlip_ReadSamples(&This->Blip, NULL, Count);
+    if (This->StemsEnabled)
+    {
+        for (uint i = 0; i < NES_AUDIO_STEM_COUNT; i++)
+            NESBlip_ReadSamples(&This->StemBlips[i], NULL, Count);
+    }
+}
 
+#define FRAME_CLK_QUARTER1 3729
+#define FRAME_CLK_HALF1 7457
+#define FRAME_CLK_QUARTER3 11186
+#define FRAME_CLK_HALF2 14916
 
-void NESAPU_StepClock(NESAPU *This)
+/* a single cpu cycle, every other one is also an apu cycle */
+static void NESAPU_StepCPUCycle(NESAPU *This, Bool8 IsAPUCycle)
 {
-#define IS_HALF_CLK(Clk) ((Clk) == 7457 || (Clk) == 14916)
-#define IS_QUARTER_CLK(Clk) (IS_HALF_CLK(Clk) || ((Clk) == 3729 || (Clk) == 11186))
+#define IS_HALF_CLK(Clk) ((Clk) == FRAME_CLK_HALF1 || (Clk) == FRAME_CLK_HALF2)
+#define IS_QUARTER_CLK(Clk) (IS_HALF_CLK(Clk) || ((Clk) == FRAME_CLK_QUARTER1 || (Clk) == FRAME_CLK_QUARTER3))
 
-    if (This->ClockCounter % 6 == 0)
+    Bool8 OutputChanged = NESAPU_TriangleStepTimer(&This->Triangle);
+    OutputChanged |= NESAPU_NoiseUpdateShiftRegister(&This->Noise);
+    OutputChanged |= NESAPU_DMCStepTimer(&This->DMC);
+
+    if (IsAPUCycle)
     {
-        This->ElapsedTime += 2.0 / NES_CPU_CLK;
         This->FrameClockCounter++;
-        NESAPU_NoiseUpdateShiftRegister(&This->Noise);
+        OutputChanged |= NESAPU_PulseStepTimer(&This->Pulse1);
+        OutputChanged |= NESAPU_PulseStepTimer(&This->Pulse2);
 
         /* adjust volume envelope */
         if (IS_QUARTER_CLK(This->FrameClockCounter))
@@ -331,6 +535,7 @@ void NESAPU_StepClock(NESAPU *This)
             NESAPU_EnvelopeUpdate(&This->Pulse2.Envelope);
             NESAPU_TriangleSequencerUpdate(&This->Triangle);
             NESAPU_EnvelopeUpdate(&This->Noise.Envelope);
+            OutputChanged = true;
         }
         /* note length and freq sweep */
         if (IS_HALF_CLK(This->FrameClockCounter))
@@ -347,34 +552,302 @@ void NESAPU_StepClock(NESAPU *This)
             );
         }
         /* the end of frame, reset the frame clk */
-        if (This->FrameClockCounter == 14916)
+        if (This->FrameClockCounter == FRAME_CLK_HALF2)
             This->FrameClockCounter = 0;
-
-
-        double Pulse1 = 
-            NESAPU_SequencerGetVolume(&This->Pulse1.Sweeper, &This->Pulse1.Envelope)
-            * GenerateSquareWave(&This->Pulse1, This->ElapsedTime); 
-        double Pulse2 = 
-            NESAPU_SequencerGetVolume(&This->Pulse2.Sweeper, &This->Pulse2.Envelope)
-            * GenerateSquareWave(&This->Pulse2, This->ElapsedTime);
-        double Triangle = NESAPU_GetTriangleSample(&This->Triangle, This->ElapsedTime);
-        double Noise = NESAPU_GetNoiseSample(&This->Noise);
-        double DMC = 0;
-
-
-        /* sound mixer, a bunch of magic, consult APU mixer section of nesdev for details */
-        This->AudioSample = INT16_MAX 
-            * ((0.752 * .5) *(Pulse1 + Pulse2) 
-             + (0.835 * .5) *Triangle 
-             + (0.494 * .5) *Noise 
-             + (0.335 * .5) *DMC
-        );
     }
-    This->ClockCounter++;
+
+    if (OutputChanged)
+        NESAPU_UpdateOutput(This);
+    This->BlipClock++;
 #undef IS_QUARTER_CLK
 #undef IS_HALF_CLK
 }
 
+/* clocks a timer Count times at once, returns how many times it ran out */
+static u64 NESAPU_AdvanceTimer(u16 *Timer, u16 Period, u64 Count)
+{
+    if (Count <= *Timer)
+    {
+        *Timer -= Count;
+        return 0;
+    }
+    Count -= *Timer + 1;
+    *Timer = Period - Count % (Period + 1);
+    return 1 + Count / (Period + 1);
+}
+
+static u64 NESAPU_MinEvent(u64 A, u64 B)
+{
+    return A < B? A : B;
+}
+
+/* the first cpu cycle from Cycle on where something that matters happens:
+ * a timer of an audible channel running out or the frame counter doing something,
+ * the timers of the silent channels still run, but only NESAPU_SkipCPUCycles has to care about them */
+static u64 NESAPU_NextEvent(const NESAPU *This, u64 Cycle)
+{
+    u64 FirstAPUCycle = Cycle + (Cycle & 1);
+
+    static const u16 FrameEvents[] = { FRAME_CLK_QUARTER1, FRAME_CLK_HALF1, FRAME_CLK_QUARTER3, FRAME_CLK_HALF2 };
+    uint i = 0;
+    while (FrameEvents[i] <= This->FrameClockCounter)
+        i++;
+    u64 Next = FirstAPUCycle + 2*(FrameEvents[i] - This->FrameClockCounter - 1);
+
+    if (NESAPU_SequencerGetVolume(&This->Pulse1.Sweeper, &This->Pulse1.Envelope))
+        Next = NESAPU_MinEvent(Next, FirstAPUCycle + 2*(u64)This->Pulse1.Timer);
+    if (NESAPU_SequencerGetVolume(&This->Pulse2.Sweeper, &This->Pulse2.Envelope))
+        Next = NESAPU_MinEvent(Next, FirstAPUCycle + 2*(u64)This->Pulse2.Timer);
+    if (This->Triangle.LinearCounter && This->Triangle.EnableFlag && This->Triangle.TimerPeriod >= 2)
+        Next = NESAPU_MinEvent(Next, Cycle + This->Triangle.Timer);
+    if (NESAPU_GetNoiseVolume(&This->Noise))
+        Next = NESAPU_MinEvent(Next, Cycle + This->Noise.Timer);
+    /* a silent DMC with nothing in its buffer only counts down its bits, which can be skipped */
+    if (!This->DMC.SilenceFlag || !This->DMC.BufferEmpty)
+        Next = NESAPU_MinEvent(Next, Cycle + This->DMC.Timer);
+    return Next;
+}
+
+/* runs Count cpu cycles starting at Cycle, none of which can have an event (see NESAPU_NextEvent) */
+static void NESAPU_SkipCPUCycles(NESAPU *This, u64 Cycle, u64 Count)
+{
+    /* how many of them are apu cycles (even cycles) */
+    u64 APUCycles = (Cycle + Count + 1)/2 - (Cycle + 1)/2;
+
+    This->Pulse1.Step -= NESAPU_AdvanceTimer(&This->Pulse1.Timer, This->Pulse1.TimerPeriod, APUCycles);
+    This->Pulse1.Step &= 0x7;
+    This->Pulse2.Step -= NESAPU_AdvanceTimer(&This->Pulse2.Timer, This->Pulse2.TimerPeriod, APUCycles);
+    This->Pulse2.Step &= 0x7;
+    NESAPU_AdvanceTimer(&This->Triangle.Timer, This->Triangle.TimerPeriod, Count); /* the sequencer is stopped */
+    for (u64 Shifts = NESAPU_AdvanceTimer(&This->Noise.Timer, This->Noise.TmpTimer, Count); Shifts; Shifts--)
+        NESAPU_NoiseShift(&This->Noise);
+    u64 DMCBits = NESAPU_AdvanceTimer(&This->DMC.Timer, This->DMC.TimerPeriod, Count);
+    This->DMC.BitsRemaining = 8 - (8 - This->DMC.BitsRemaining + DMCBits) % 8;
+
+    This->FrameClockCounter += APUCycles;
+    This->BlipClock += Count;
+}
+
+/* runs the APU up to master clk Clk, 
+ * the APU only has to be caught up before its registers are touched and before reading samples out of it */
+void NESAPU_CatchUp(NESAPU *This, u64 Clk)
+{
+    if (Clk <= This->ClockCounter)
+        return;
+
+    /* cpu cycles happen every 3 master clks */
+    u64 Cycle = (This->ClockCounter + 2) / 3;
+    u64 EndCycle = (Clk + 2) / 3;
+    while (Cycle < EndCycle)
+    {
+        /* the samples are only ever read in blocks of up to APU_MAX_SAMPLES_PER_READ, 
+         * anything older than that is thrown away before the blip buffer overflows 
+         * (nobody's been reading samples for a while, the emulator is being stepped in the debugger) */
+        if (This->BlipClock >= APU_MAX_UNREAD_CYCLES)
+        {
+            NESAPU_EndBlipFrame(This);
+            uint Available = NESBlip_SamplesAvailable(&This->Blip);
+            if (Available > APU_MAX_SAMPLES_PER_READ)
+                NESAPU_DiscardSamples(This, Available - APU_MAX_SAMPLES_PER_READ);
+        }
+
+        u64 Next = NESAPU_NextEvent(This, Cycle);
+        if (Next > EndCycle)
+            Next = EndCycle;
+        if (Next - Cycle > APU_MAX_UNREAD_CYCLES)
+            Next = Cycle + APU_MAX_UNREAD_CYCLES;
+        NESAPU_SkipCPUCycles(This, Cycle, Next - Cycle);
+
+        Cycle = Next;
+        if (Cycle < EndCycle)
+        {
+            NESAPU_StepCPUCycle(This, Cycle % 2 == 0);
+            Cycle++;
+        }
+    }
+    This->ClockCounter = Clk;
+}
+
+/* how many samples NESAPU_ReadSamples has, everything up to now has to have been clocked already */
+uint NESAPU_SamplesAvailable(NESAPU *This)
+{
+    NESAPU_EndBlipFrame(This);
+    return NESBlip_SamplesAvailable(&This->Blip);
+}
+
+/* samples come out at SampleRate from now on, can be changed on the fly without a glitch */
+void NESAPU_SetSampleRate(NESAPU *This, u32 SampleRate)
+{
+    NESAPU_EndBlipFrame(This);
+    NESBlip_SetSampleRate(&This->Blip, SampleRate);
+    for (uint i = 0; i < NES_AUDIO_STEM_COUNT; i++)
+        NESBlip_SetSampleRate(&This->StemBlips[i], SampleRate);
+}
+
+/* the latest Count samples, everything up to now has to have been clocked already, 
+ * if there aren't that many yet, the rest is filled with the last sample */
+void NESAPU_ReadSamples(NESAPU *This, i16 *Out, uint Count)
+{
+    DEBUG_ASSERT(Count <= APU_MAX_SAMPLES_PER_READ);
+    NESAPU_EndBlipFrame(This);
+
+    /* anything before the newest samples would only come out late */
+    uint Available = NESBlip_SamplesAvailable(&This->Blip);
+    if (Available > Count)
+        NESAPU_DiscardSamples(This, Available - Count);
+
+    uint Read = NESBlip_ReadSamples(&This->Blip, Out, Count);
+    if (Read)
+        This->LastSample = Out[Read - 1];
+    for (uint i = Read; i < Count; i++)
+        Out[i] = This->LastSample;
+}
+
+/* the stems of the samples the last NESAPU_ReadSamples returned, has to be called right after it with the same Count, 
+ * Out has room for Count samples of every stem (and the stems have to be enabled) */
+void NESAPU_ReadStems(NESAPU *This, i16 *Out[NES_AUDIO_STEM_COUNT], uint Count)
+{
+    DEBUG_ASSERT(This->StemsEnabled);
+    for (uint Stem = 0; Stem < NES_AUDIO_STEM_COUNT; Stem++)
+    {
+        uint Read = NESBlip_ReadSamples(&This->StemBlips[Stem], Out[Stem], Count);
+        if (Read)
+            This->LastStemSample[Stem] = Out[Stem][Read - 1];
+        for (uint i = Read; i < Count; i++)
+            Out[Stem][i] = This->LastStemSample[Stem];
+    }
+}
+
+/* the master clk the DMC's next sample byte has to be fetched at (the cpu cycle after its buffer empties out), 
+ * APU_NO_DMC_FETCH if it won't need one. Stays right until the APU's registers are touched or a byte is fetched, 
+ * This has to be caught up to now */
+u64 NESAPU_NextDMCFetch(const NESAPU *This)
+{
+    const DMCChannel *DMC = &This->DMC;
+    if (!DMC->BytesRemaining)
+        return APU_NO_DMC_FETCH;
+
+    u64 Cycle = (This->ClockCounter + 2) / 3;
+    if (DMC->BufferEmpty)
+        return 3*Cycle;
+
+    /* the buffer goes into the shift register at the timer's BitsRemaining'th expiry */
+    u64 EmptyCycle = Cycle + DMC->Timer + (u64)(DMC->BitsRemaining - 1)*(DMC->TimerPeriod + 1);
+    return 3*(EmptyCycle + 1);
+}
+
+u16 NESAPU_DMCFetchAddr(const NESAPU *This)
+{
+    return This->DMC.CurrentAddr;
+}
+
+/* Byte was fetched from NESAPU_DMCFetchAddr at NESAPU_NextDMCFetch, This has to be caught up to then */
+void NESAPU_DMCLoadSample(NESAPU *This, u8 Byte)
+{
+    DMCChannel *DMC = &This->DMC;
+    DEBUG_ASSERT(DMC->BufferEmpty && DMC->BytesRemaining);
+
+    DMC->Buffer = Byte;
+    DMC->BufferEmpty = false;
+    DMC->CurrentAddr = DMC->CurrentAddr == 0xFFFF? 0x8000 : DMC->CurrentAddr + 1;
+    DMC->BytesRemaining--;
+    if (0 == DMC->BytesRemaining)
+    {
+        if (DMC->LoopFlag)
+            NESAPU_DMCRestart(DMC);
+        else if (DMC->IRQEnableFlag)
+            DMC->IRQFlag = true;
+    }
+}
+
+/* whether the APU is pulling the cpu's IRQ line low, 
+ * only changes on NESAPU_DMCLoadSample and register accesses */
+Bool8 NESAPU_IRQ(const NESAPU *This)
+{
+    return This->DMC.IRQFlag;
+}
+
+
+
+void NESAPU_Reset(NESAPU *This)
+{
+    NESBlip_Clear(&This->Blip);
+    This->ClockCounter = 0;
+    This->BlipClock = 0;
+    This->Output = 0;
+    This->LastSample = 0;
+    for (uint i = 0; i < NES_AUDIO_STEM_COUNT; i++)
+    {
+        NESBlip_Clear(&This->StemBlips[i]);
+        This->StemOutput[i] = 0;
+        This->LastStemSample[i] = 0;
+    }
+    This->Pulse1    = (Sequencer) { 0 };
+    This->Pulse2    = (Sequencer) { 0 };
+    This->Triangle  = (TriangleSequencer) { 0 };
+    This->Noise     = (NoiseSequencer) { 
+        .LinearFeedbackShiftRegister = 1 
+    };
+    This->DMC       = (DMCChannel) {
+        .SilenceFlag = true,
+        .BufferEmpty = true,
+        .BitsRemaining = 8,
+        .TimerPeriod = This->NTSCDMCPeriodTable[0] - 1,
+        .Timer = This->NTSCDMCPeriodTable[0] - 1,
+        .SampleAddr = 0xC000,
+        .SampleLength = 1,
+    };
+
+    /* the triangle rests at the top of its sequence */
+    NESAPU_UpdateOutput(This);
+}
+
+NESAPU NESAPU_Init(u64 SeedForNoiseGeneration, u32 SampleRate)
+{
+    NESAPU APU = {
+        /* https://www.nesdev.org/wiki/APU_Length_Counter */
+        .LengthCounterTable = {
+            10, 254, 20,  2, 40,  4, 80,  6, 160,  8, 60, 10, 14, 12, 26, 14, 
+            12,  16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30
+        },
+        .NTSCNoisePeriodTable = {
+            4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068
+        },
+        /* https://www.nesdev.org/wiki/APU_DMC, in cpu cycles */
+        .NTSCDMCPeriodTable = {
+            428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54
+        },
+    };
+    NESAPU_InitMixerTables();
+    NESBlip_Init(&APU.Blip, NES_CPU_CLK, SampleRate);
+    for (uint i = 0; i < NES_AUDIO_STEM_COUNT; i++)
+        NESBlip_Init(&APU.StemBlips[i], NES_CPU_CLK, SampleRate);
+    NESAPU_Reset(&APU);
+    return APU;
+}
+
+/* separate samples for every channel (see NESAPU_ReadStems) alongside the mixed ones, 
+ * costs a blip buffer step per channel change */
+void NESAPU_EnableStems(NESAPU *This, Bool8 Enable)
+{
+    if (Enable == This->StemsEnabled)
+        return;
+
+    /* line the stems up with the samples still in Blip, those all start out silent */
+    NESAPU_EndBlipFrame(This);
+    This->StemsEnabled = Enable;
+    if (Enable)
+    {
+        for (uint i = 0; i < NES_AUDIO_STEM_COUNT; i++)
+        {
+            NESBlip_Clear(&This->StemBlips[i]);
+            This->StemBlips[i].Offset = This->Blip.Offset;
+            This->StemOutput[i] = 0;
+        }
+        NESAPU_UpdateOutput(This);
+    }
+}
+
 
 
 /* the following code has even more magic numbers, 
@@ -387,16 +860,16 @@ u8 NESAPU_ExternalRead(NESAPU *This, u16 Addr)
     {
     default: 
         break;
-    /* DMC */
-    case 0x4010:
-    case 0x4011:
-    case 0x4012:
-    case 0x4013:
     /* Channel enable/length counter stat */
     case 0x4015:
-    /* frame counter */
-    case 0x4017:
-        break;
+    {
+        /* the triangle doesn't have a length counter here, and there's no frame interrupt yet */
+        return (This->Pulse1.Envelope.LengthCounter != 0) << 0
+            | (This->Pulse2.Envelope.LengthCounter != 0) << 1
+            | (This->Noise.Envelope.LengthCounter != 0) << 3
+            | (This->DMC.BytesRemaining != 0) << 4
+            | This->DMC.IRQFlag << 7;
+    }
     }
     return 0;
 }
@@ -405,13 +878,12 @@ u8 NESAPU_ExternalRead(NESAPU *This, u16 Addr)
 
 static void NESAPU_WritePulseRegisters(NESAPU *This, Sequencer *Pulse, u16 Addr, u8 Byte)
 {
-    static const double DutyCycleLookup[4] = { .125, .250, .500, .750 };
     switch (Addr)
     {
     case 0x4000:
     case 0x4004:
     {
-        Pulse->DutyCyclePercentage = DutyCycleLookup[Byte >> 6];
+        Pulse->Duty = Byte >> 6;
         Pulse->Envelope.LoopFlag = Byte & (1 << 5);
         Pulse->Envelope.ConstantVolumeFlag = Byte & (1 << 4);
         Pulse->Envelope.Volume = Byte & 0x0F;
@@ -435,6 +907,7 @@ static void NESAPU_WritePulseRegisters(NESAPU *This, Sequencer *Pulse, u16 Addr,
     {
         MASKED_LOAD(Pulse->TmpTimerPeriod, (u16)Byte << 8, 0x0700);
         Pulse->TimerPeriod = Pulse->TmpTimerPeriod;
+        Pulse->Step = 0;
         Pulse->Envelope.LengthCounter = This->LengthCounterTable[Byte >> 3] + 1;
         Pulse->Envelope.StartFlag = true;
     } break;
@@ -484,7 +957,7 @@ void NESAPU_ExternalWrite(NESAPU *This, u16 Addr, u8 Byte)
     } break; 
     case 0x400E:
     {
-        This->Noise.TmpTimer = This->NTSCNoisePeriodTable[Byte & 0x0F];
+        This->Noise.TmpTimer = This->NTSCNoisePeriodTable[Byte & 0x0F] - 1;
         This->Noise.ModeFlag = Byte & 0x80;
     } break;
     case 0x400F:
@@ -496,10 +969,24 @@ void NESAPU_ExternalWrite(NESAPU *This, u16 Addr, u8 Byte)
 
     /* DMC */
     case 0x4010:
+    {
+        This->DMC.IRQEnableFlag = Byte & 0x80;
+        This->DMC.LoopFlag = Byte & 0x40;
+        This->DMC.TimerPeriod = This->NTSCDMCPeriodTable[Byte & 0x0F] - 1;
+        if (!This->DMC.IRQEnableFlag)
+            This->DMC.IRQFlag = false;
+    } break;
     case 0x4011:
+    {
+        This->DMC.Output = Byte & 0x7F;
+    } break;
     case 0x4012:
+    {
+        This->DMC.SampleAddr = 0xC000 + (u16)Byte*64;
+    } break;
     case 0x4013:
     {
+        This->DMC.SampleLength = (u16)Byte*16 + 1;
     } break;
 
 
@@ -510,6 +997,13 @@ void NESAPU_ExternalWrite(NESAPU *This, u16 Addr, u8 Byte)
         This->Pulse2.Envelope.EnableFlag    = Byte & (1 << 1);
         This->Triangle.EnableFlag           = Byte & (1 << 2);
         This->Noise.Envelope.EnableFlag     = Byte & (1 << 3);
+
+        /* the DMC starts over only if it had finished, its buffer gets fetched right away if it's empty */
+        if (!(Byte & (1 << 4)))
+            This->DMC.BytesRemaining = 0;
+        else if (0 == This->DMC.BytesRemaining)
+            NESAPU_DMCRestart(&This->DMC);
+        This->DMC.IRQFlag = false;
     } break;
 
 
@@ -518,6 +1012,9 @@ void NESAPU_ExternalWrite(NESAPU *This, u16 Addr, u8 Byte)
     {
     } break;
     }
+
+    /* volume, enable flags and such take effect right away */
+    NESAPU_UpdateOutput(This);
 }
 
 
@@ -0,0 +1,142 @@
+#ifndef NES_AUDIO_RING_C
+#define NES_AUDIO_RING_C
+
+/*
+ * single producer single consumer ring of samples, lock free:
+ * the emulator thread writes into it, the audio thread reads out of it, and neither ever waits on the other. 
+ * A ring is either written with NESAudioRing_Write and read with NESAudioRing_Read (nothing is lost, 
+ * what doesn't fit is dropped), or written with NESAudioRing_Overwrite and read with NESAudioRing_ReadLatest 
+ * (the newest samples always make it in, for taps that nobody has to keep up with)
+ */
+
+#include "Common.h"
+#include "Utils.h"
+#include "Nes.h"
+
+
+#define AUDIO_RING_SIZE 8192 /* power of 2 */
+
+typedef struct NESAudioRing
+{
+    i16 Samples[AUDIO_RING_SIZE];
+    /* both only ever go up (and wrap around), the difference is how many samples are in the ring */
+    volatile u32 WriteIndex; /* only written by the producer */
+    volatile u32 ReadIndex;  /* only written by the consumer */
+    /* NESAudioRing_Overwrite only, the slots up to here could be in the middle of being overwritten, 
+     * and the samples before DiscardIndex are stale */
+    volatile u32 OverwriteIndex; /* only written by the producer */
+    volatile u32 DiscardIndex;   /* only written by the producer */
+} NESAudioRing;
+
+
+/* can be called from either side, the result is only exact on the producer side for the free space
+ * and on the consumer side for the samples available */
+u32 NESAudioRing_Count(const NESAudioRing *This)
+{
+    return This->WriteIndex - This->ReadIndex;
+}
+
+/* producer side, returns how many were written, the rest didn't fit and is dropped */
+u32 NESAudioRing_Write(NESAudioRing *This, const i16 *Samples, u32 Count)
+{
+    u32 Write = This->WriteIndex;
+    u32 Free = AUDIO_RING_SIZE - (Write - This->ReadIndex);
+    /* full barrier (storing the same value back),
+     * so that the samples are only written after the consumer is seen to be done with them */
+    Platform_AtomicExchange(&This->WriteIndex, Write);
+
+    if (Count > Free)
+        Count = Free;
+    for (u32 i = 0; i < Count; i++)
+        This->Samples[(Write + i) & (AUDIO_RING_SIZE - 1)] = Samples[i];
+
+    /* publish them */
+    Platform_AtomicExchange(&This->WriteIndex, Write + Count);
+    return Count;
+}
+
+/* consumer side, returns how many were read */
+u32 NESAudioRing_Read(NESAudioRing *This, i16 *Out, u32 Count)
+{
+    u32 Read = This->ReadIndex;
+    u32 Available = This->WriteIndex - Read;
+    /* full barrier, so that the samples are only read after WriteIndex was */
+    Platform_AtomicExchange(&This->ReadIndex, Read);
+
+    if (Count > Available)
+        Count = Available;
+    for (u32 i = 0; i < Count; i++)
+        Out[i] = This->Samples[(Read + i) & (AUDIO_RING_SIZE - 1)];
+
+    /* hand the space back to the producer */
+    Platform_AtomicExchange(&This->ReadIndex, Read + Count);
+    return Count;
+}
+
+/* producer side, never drops the new samples, pushes the oldest ones out to make room instead */
+void NESAudioRing_Overwrite(NESAudioRing *This, const i16 *Samples, u32 Count)
+{
+    if (Count > AUDIO_RING_SIZE)
+    {
+        Samples += Count - AUDIO_RING_SIZE;
+        Count = AUDIO_RING_SIZE;
+    }
+    u32 Write = This->WriteIndex;
+    /* claim the slots before touching them, so that a consumer reading them can tell (see NESAudioRing_ReadLatest) */
+    Platform_AtomicExchange(&This->OverwriteIndex, Write + Count);
+
+    for (u32 i = 0; i < Count; i++)
+        This->Samples[(Write + i) & (AUDIO_RING_SIZE - 1)] = Samples[i];
+
+    /* publish them */
+    Platform_AtomicExchange(&This->WriteIndex, Write + Count);
+}
+
+/* producer side, of a ring written with NESAudioRing_Overwrite: everything in it is stale, the consumer won't see any of it */
+void NESAudioRing_Discard(NESAudioRing *This)
+{
+    Platform_AtomicExchange(&This->DiscardIndex, This->WriteIndex);
+}
+
+/* consumer side, of a ring written with NESAudioRing_Overwrite, returns how many were read: 
+ * the oldest Count (at most) samples, or the newest Count once more than MaxBacklog are waiting */
+u32 NESAudioRing_ReadLatest(NESAudioRing *This, i16 *Out, u32 Count, u32 MaxBacklog)
+{
+    DEBUG_ASSERT(MaxBacklog < AUDIO_RING_SIZE);
+    if (Count > AUDIO_RING_SIZE)
+        Count = AUDIO_RING_SIZE;
+    u32 Read = This->ReadIndex;
+    u32 Write = This->WriteIndex;
+    /* full barrier, so that the samples are only read after WriteIndex was */
+    Platform_AtomicExchange(&This->ReadIndex, Read);
+
+    /* fell behind (or got lapped), skip to the newest */
+    u32 Available = Write - Read;
+    if (Available > MaxBacklog && Available > Count)
+    {
+        Read = Write - Count;
+        Available = Count;
+    }
+    if (Count > Available)
+        Count = Available;
+    for (u32 i = 0; i < Count; i++)
+        Out[i] = This->Samples[(Read + i) & (AUDIO_RING_SIZE - 1)];
+
+    /* full barrier, OverwriteIndex is only read after the samples were: 
+     * the ones the producer could have overwritten (or discarded) in the meantime are thrown away */
+    Platform_AtomicExchange(&This->ReadIndex, Read);
+    u32 Intact = This->OverwriteIndex - AUDIO_RING_SIZE; /* the oldest sample still intact */
+    u32 Discarded = This->DiscardIndex;
+    if ((i32)(Discarded - Intact) > 0)
+        Intact = Discarded;
+    u32 Lost = (i32)(Intact - Read) > 0? Intact - Read : 0;
+    if (Lost > Count)
+        Lost = Count;
+    for (u32 i = Lost; i < Count; i++)
+        Out[i - Lost] = Out[i];
+
+    Platform_AtomicExchange(&This->ReadIndex, Read + Count);
+    return Count - Lost;
+}
+
+#endif /* NES_AUDIO_RING_C */
@@ -0,0 +1,197 @@
+#ifndef NES_BLIP_BUFFER_C
+#define NES_BLIP_BUFFER_C
+
+/*
+ * band-limited step buffer: instead of point sampling the channels (which aliases like crazy),
+ * every change in the output level is added as a band-limited step at the exact clock it happened,
+ * and the steps get summed up into samples when they're read out.
+ * Same idea as blargg's blip_buf: http://www.slack.net/~ant/bl-synth/
+ */
+
+#include "Common.h"
+#include "Utils.h"
+#include "Nes.h"
+
+
+#define BLIP_BUFFER_SIZE 8192       /* in samples */
+#define BLIP_KERNEL_WIDTH 32        /* in samples, also the delay of the output */
+#define BLIP_PHASE_BITS 6
+#define BLIP_PHASES (1 << BLIP_PHASE_BITS)
+#define BLIP_KERNEL_BITS 14         /* every phase of the kernel sums up to exactly 1 << BLIP_KERNEL_BITS */
+#define BLIP_BASS_SHIFT 9           /* the highpass that gets rid of DC, about 15Hz at 48kHz */
+
+typedef struct NESBlipBuffer
+{
+    u32 ClockRate;
+    u32 SampleRate;
+    /* where clock 0 is in the buffer, in 1/ClockRate of a sample, 
+     * a clock is exactly SampleRate of those so there's no rounding error to pile up however long it runs */
+    u64 Offset;
+    i32 Integrator;
+    i32 Samples[BLIP_BUFFER_SIZE + BLIP_KERNEL_WIDTH];
+} NESBlipBuffer;
+
+/* the step response's derivative (a windowed sinc) at every phase between 2 samples */
+static i32 sBlipKernel[BLIP_PHASES][BLIP_KERNEL_WIDTH];
+static Bool8 sBlipKernelInitialized = false;
+
+
+/* only used to build the kernel, Sin64 isn't precise enough for this */
+static double NESBlip_Sin(double x)
+{
+    /* to -pi..pi, then to -pi/2..pi/2 */
+    x -= TAU * (double)(i64)(x * (1.0 / TAU));
+    if (x > PI)
+        x -= TAU;
+    if (x < -PI)
+        x += TAU;
+    if (x > PI/2)
+        x = PI - x;
+    if (x < -PI/2)
+        x = -PI - x;
+
+    double x2 = x*x;
+    return x*(1 - x2/6*(1 - x2/20*(1 - x2/42*(1 - x2/72*(1 - x2/110)))));
+}
+
+static void NESBlip_InitKernel(void)
+{
+    if (sBlipKernelInitialized)
+        return;
+
+    /* cut off a bit below nyquist so the transition band doesn't alias back down */
+    static const double Cutoff = .9;
+    for (uint Phase = 0; Phase < BLIP_PHASES; Phase++)
+    {
+        double Taps[BLIP_KERNEL_WIDTH];
+        double Sum = 0;
+        for (uint i = 0; i < BLIP_KERNEL_WIDTH; i++)
+        {
+            /* distance from the step, the step is in the middle of the kernel */
+            double x = (double)i - (BLIP_KERNEL_WIDTH/2 - 1) - (double)Phase / BLIP_PHASES;
+            double Sinc = x == 0
+                ? 1
+                : NESBlip_Sin(PI * Cutoff * x) / (PI * Cutoff * x);
+
+            /* blackman window */
+            double w = PI * x / (BLIP_KERNEL_WIDTH/2);
+            double Window = .42 + .5*NESBlip_Sin(w + PI/2) + .08*NESBlip_Sin(2*w + PI/2);
+            if (x <= -BLIP_KERNEL_WIDTH/2 || x >= BLIP_KERNEL_WIDTH/2)
+                Window = 0;
+
+            Taps[i] = Sinc * Window;
+            Sum += Taps[i];
+        }
+
+        /* normalize so that a step of n ends up exactly n higher, the rounding error goes in the middle */
+        i32 Total = 0;
+        for (uint i = 0; i < BLIP_KERNEL_WIDTH; i++)
+        {
+            double Tap = Taps[i] / Sum * (1 << BLIP_KERNEL_BITS);
+            sBlipKernel[Phase][i] = (i32)(Tap < 0? Tap - .5 : Tap + .5);
+            Total += sBlipKernel[Phase][i];
+        }
+        sBlipKernel[Phase][BLIP_KERNEL_WIDTH/2 - 1] += (1 << BLIP_KERNEL_BITS) - Total;
+    }
+    sBlipKernelInitialized = true;
+}
+
+
+
+void NESBlip_Clear(NESBlipBuffer *This)
+{
+    This->Offset = 0;
+    This->Integrator = 0;
+    Memset(This->Samples, 0, sizeof This->Samples);
+}
+
+/* ClockRate: how many clocks (whatever AddDelta is counting in) per second */
+void NESBlip_Init(NESBlipBuffer *This, u32 ClockRate, u32 SampleRate)
+{
+    DEBUG_ASSERT(ClockRate >= SampleRate);
+    NESBlip_InitKernel();
+
+    This->ClockRate = ClockRate;
+    This->SampleRate = SampleRate;
+    NESBlip_Clear(This);
+}
+
+/* takes effect from the last NESBlip_EndFrame on, nothing already in the buffer moves */
+void NESBlip_SetSampleRate(NESBlipBuffer *This, u32 SampleRate)
+{
+    DEBUG_ASSERT(This->ClockRate >= SampleRate);
+    This->SampleRate = SampleRate;
+}
+
+/* Clock: clocks since the last NESBlip_EndFrame */
+void NESBlip_AddDelta(NESBlipBuffer *This, u32 Clock, i32 Delta)
+{
+    u64 Pos = This->Offset + (u64)Clock*This->SampleRate;
+    u64 Index = Pos / This->ClockRate;
+
+    /* rounded to the nearest phase */
+    u64 Phase = ((Pos % This->ClockRate)*2*BLIP_PHASES + This->ClockRate) / (2*(u64)This->ClockRate);
+    if (Phase == BLIP_PHASES)
+    {
+        Phase = 0;
+        Index++;
+    }
+    if (Index >= BLIP_BUFFER_SIZE)
+    {
+        DEBUG_ASSERT(false && "blip buffer overflowed, read the samples out more often");
+        return;
+    }
+
+    i32 *Out = &This->Samples[Index];
+    const i32 *Kernel = sBlipKernel[Phase];
+    for (uint i = 0; i < BLIP_KERNEL_WIDTH; i++)
+        Out[i] += Kernel[i] * Delta;
+}
+
+/* the clocks since the last NESBlip_EndFrame are done, their samples can be read out */
+void NESBlip_EndFrame(NESBlipBuffer *This, u32 Clocks)
+{
+    This->Offset += (u64)Clocks*This->SampleRate;
+    DEBUG_ASSERT(This->Offset / This->ClockRate <= BLIP_BUFFER_SIZE);
+}
+
+uint NESBlip_SamplesAvailable(const NESBlipBuffer *This)
+{
+    return This->Offset / This->ClockRate;
+}
+
+/* returns how many were actually read, Out can be NULL to throw them away */
+uint NESBlip_ReadSamples(NESBlipBuffer *This, i16 *Out, uint Count)
+{
+    uint Available = NESBlip_SamplesAvailable(This);
+    if (Count > Available)
+        Count = Available;
+
+    i32 Integrator = This->Integrator;
+    for (uint i = 0; i < Count; i++)
+    {
+        i32 Sample = Integrator >> BLIP_KERNEL_BITS;
+        Integrator += This->Samples[i];
+        if (Sample > INT16_MAX)
+            Sample = INT16_MAX;
+        if (Sample < INT16_MIN)
+            Sample = INT16_MIN;
+        if (Out)
+            Out[i] = Sample;
+
+        /* leak a bit of the sum back out, which removes DC */
+        Integrator -= Sample * (1 << (BLIP_KERNEL_BITS - BLIP_BASS_SHIFT));
+    }
+    This->Integrator = Integrator;
+
+    /* the samples still being built go to the front */
+    uint Remaining = Available - Count + BLIP_KERNEL_WIDTH;
+    for (uint i = 0; i < Remaining; i++)
+        This->Samples[i] = This->Samples[Count + i];
+    for (uint i = Remaining; i < Remaining + Count; i++)
+        This->Samples[i] = 0;
+    This->Offset -= (u64)Count*This->ClockRate;
+    return Count;
+}
+
+#endif /* NES_BLIP_BUFFER_C */
@@ -3,6 +3,7 @@
 #include "Utils.h"
 #include "Common.h"
 #include "Cartridge.h"
+#include "Nes.h"
 
 #define MAPPER_INTERFACE_IMPL
 #   include "MapperInterface.h"
@@ -59,6 +60,10 @@ void NESCartridge_Destroy(NESCartridge *Cartridge)
         case 2: NESMapper002_Destroy(Cartridge->MapperInterface); break;
         case 3: NESMapper003_Destroy(Cartridge->MapperInterface); break;
         }
+        if (Cartridge->NametableVRam)
+        {
+            free(Cartridge->NametableVRam);
+        }
         *Cartridge = (NESCartridge){ 0 };
     }
 }
@@ -82,6 +87,7 @@ NESCartridge NESCartridge_Init(
     NESCartridge Cartridge = {
         .MirroringMode = MirroringMode,
         .MapperID = MapperID,
+        .NametableVRam = NULL,
         .MapperInterface = NULL,
     };
 
@@ -91,6 +97,16 @@ NESCartridge NESCartridge_Init(
     case 2: Cartridge.MapperInterface = NESMapper002_Init(PrgRom, PrgRomSize, ChrRamSize); break;
     case 3: Cartridge.MapperInterface = NESMapper003_Init(PrgRom, PrgRomSize, ChrRom, ChrRomSize, HasBusConflict); break;
     }
+
+    /* four screen layout: the cartridge provides vram for the 2 nametables the PPU does not have */
+    if (Cartridge.MapperInterface && AlternativeNametableLayout)
+    {
+        isize VRamSize = 2*NES_NAMETABLE_SIZE;
+        Cartridge.NametableVRam = malloc(VRamSize);
+        DEBUG_ASSERT(Cartridge.NametableVRam);
+        Memset(Cartridge.NametableVRam, 0, VRamSize);
+        Cartridge.MirroringMode = NAMETABLE_FOURSCREEN;
+    }
     return Cartridge;
 }
 
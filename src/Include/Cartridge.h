@@ -9,10 +9,12 @@ typedef enum NESNametableMirroring
     NAMETABLE_VERTICAL,
     NAMETABLE_ONESCREEN_HI,
     NAMETABLE_ONESCREEN_LO,
+    NAMETABLE_FOURSCREEN,
 } NESNametableMirroring;
 typedef struct NESCartridge
 {
     NESNametableMirroring MirroringMode;
+    u8 *NametableVRam; /* extra 2kb of vram on the cartridge, only for NAMETABLE_FOURSCREEN */
     NESMapperID MapperID;
     NESMapperInterface *MapperInterface;
 } NESCartridge;
@@ -6,6 +6,8 @@
 #define NES_CPU_CLK 1789773
 #define NES_PPU_CLK NES_CPU_CLK*3
 #define NES_MASTER_CLK NES_PPU_CLK
+#define NES_DEFAULT_AUDIO_SAMPLE_RATE 48000
+#define NES_DEFAULT_AUDIO_LATENCY_MS 40
 
 #define NES_CPU_RAM_SIZE 0x0800
 #define NES_SCREEN_HEIGHT 240
@@ -17,6 +19,12 @@
 #define NES_PATTERN_TABLE_SIZE 0x1000
 #define NES_PATTERN_TABLE_WIDTH_PIX 16*8
 #define NES_PATTERN_TABLE_HEIGHT_PIX 16*8
+#define NES_NAMETABLE_VIEW_WIDTH (NES_SCREEN_WIDTH * 2)
+#define NES_NAMETABLE_VIEW_HEIGHT (NES_SCREEN_HEIGHT * 2)
+#define NES_ATTRIBUTE_VIEW_WIDTH (NES_NAMETABLE_VIEW_WIDTH / 16)
+#define NES_ATTRIBUTE_VIEW_HEIGHT (NES_NAMETABLE_VIEW_HEIGHT / 16)
+#define NES_SPRITE_VIEW_WIDTH (8 * 8)
+#define NES_SPRITE_VIEW_HEIGHT (8 * 16)
 
 
 typedef struct Platform_AudioConfig 
@@ -34,27 +42,149 @@ typedef struct Platform_ThreadContext
     isize SizeBytes;
 } Platform_ThreadContext;
 
+typedef enum Nes_PixelFormat 
+{
+    NES_PIXELFORMAT_XRGB8888 = 0,   /* u32: 0x00RRGGBB */
+    NES_PIXELFORMAT_RGB565,         /* u16: rrrrrggg gggbbbbb */
+    NES_PIXELFORMAT_ABGR8888,       /* u32: 0xFFBBGGRR (RGBA in memory) */
+    NES_PIXELFORMAT_PALETTE_INDEX,  /* u16: 0000000e eecccccc, PPU color index and emphasis bits (PPUMASK >> 5) */
+} Nes_PixelFormat;
+
+typedef enum Nes_Scaler 
+{
+    NES_SCALER_NONE = 0,
+    NES_SCALER_NEAREST2X,
+    NES_SCALER_NEAREST3X,
+    NES_SCALER_SCALE2X,
+    NES_SCALER_SCALE3X,
+    NES_SCALER_XBR2X,       /* blends along the edges it finds, so it adds colors */
+    NES_SCALER_COUNT,
+} Nes_Scaler;
+
 typedef struct Platform_FrameBuffer 
 {
     const void *Data;
     u32 Width, Height;
+    u32 Sequence; /* increases with every frame drawn, the same value means the same frame */
+    isize Pitch; /* bytes between rows */
+    Nes_PixelFormat PixelFormat;
+    /* only from Nes_PlatformQueryFrameBuffer: the pixels are exactly the same as 
+     * the ones it returned the previous time (same frame, or a new one that looks just the same), 
+     * so there is nothing new to upload or encode */
+    Bool8 Unchanged;
 } Platform_FrameBuffer;
 
-typedef struct Nes_DisplayableStatus 
+/* the debug view, split into sections that are each only recomputed when what they show has changed, 
+ * see Nes_PlatformQueryDebugRegisters and friends */
+typedef struct Nes_DebugRegisters 
 {
     u16 PC, SP, StackValue;
     u8 A, X, Y;
     u8 N, V, U, B, D, I, Z, C;
+} Nes_DebugRegisters;
 
-    u32 Palette[NES_PALETTE_SIZE];
-    u32 LeftPatternTable[NES_PATTERN_TABLE_HEIGHT_PIX][NES_PATTERN_TABLE_WIDTH_PIX];
-    u32 RightPatternTable[NES_PATTERN_TABLE_HEIGHT_PIX][NES_PATTERN_TABLE_WIDTH_PIX];
-    Bool8 PatternTablesAvailable;
+typedef struct Nes_DebugPalette 
+{
+    u32 Colors[NES_PALETTE_SIZE];
+} Nes_DebugPalette;
+
+typedef struct Nes_DebugPatternTables 
+{
+    u32 Left[NES_PATTERN_TABLE_HEIGHT_PIX][NES_PATTERN_TABLE_WIDTH_PIX];
+    u32 Right[NES_PATTERN_TABLE_HEIGHT_PIX][NES_PATTERN_TABLE_WIDTH_PIX];
+    Bool8 Available;
+} Nes_DebugPatternTables;
 
-    char DisasmBeforePC[512];
-    char DisasmAtPC[128];
-    char DisasmAfterPC[512];
-} Nes_DisplayableStatus;
+typedef struct Nes_DebugDisassembly 
+{
+    char BeforePC[512];
+    char AtPC[128];
+    char AfterPC[512];
+} Nes_DebugDisassembly;
+
+/* the views below are drawn from the PPU's state at the end of the latest frame, 
+ * Available is false until there is one */
+
+/* the 4 logical nametables (0x2000 top left, 0x2400 top right, 0x2800 bottom left, 0x2C00 bottom right), 
+ * the visible screen (256x240 starting at ScrollX, ScrollY, wraps around) is outlined */
+typedef struct Nes_DebugNametables 
+{
+    u32 Pixels[NES_NAMETABLE_VIEW_HEIGHT][NES_NAMETABLE_VIEW_WIDTH];
+    u16 ScrollX, ScrollY;
+    Bool8 Available;
+} Nes_DebugNametables;
+
+/* background palette of every 16x16 area, same layout as Nes_DebugNametables, 
+ * Pixels has a different color for each palette */
+typedef struct Nes_DebugAttributes 
+{
+    u8 Palettes[NES_ATTRIBUTE_VIEW_HEIGHT][NES_ATTRIBUTE_VIEW_WIDTH];
+    u32 Pixels[NES_ATTRIBUTE_VIEW_HEIGHT][NES_ATTRIBUTE_VIEW_WIDTH];
+    Bool8 Available;
+} Nes_DebugAttributes;
+
+typedef struct Nes_DebugSprite 
+{
+    u8 X, Y, Tile, Attribute; /* as they are in OAM */
+} Nes_DebugSprite;
+
+/* Pixels has the 64 sprites 8 per row, each in an 8x16 cell */
+typedef struct Nes_DebugSprites 
+{
+    Nes_DebugSprite Entries[64];
+    u32 Pixels[NES_SPRITE_VIEW_HEIGHT][NES_SPRITE_VIEW_WIDTH];
+    Bool8 Is8x16;
+    Bool8 Available;
+} Nes_DebugSprites;
+
+/* a cpu access to a PPU register, see Nes_SetRasterRecorder */
+typedef struct Nes_RasterEvent 
+{
+    u64 Clk;        /* master clock */
+    i16 Scanline;   /* -1 (pre-render) to 260 */
+    u16 Dot;        /* the dot the PPU was about to draw, 0 to 340 */
+    u8 Register;    /* 0 to 7, for $2000 to $2007 */
+    u8 Value;       /* written or read */
+    Bool8 IsWrite;
+} Nes_RasterEvent;
+
+#define NES_RASTER_LOG_SIZE 4096
+typedef struct Nes_RasterLog 
+{
+    u32 FrameNumber;
+    u32 EventCount;
+    u32 DroppedEvents; /* once Events is full */
+    /* writes (other than to OAMADDR and OAMDATA) that landed between dot 1 and 256 of a visible scanline 
+     * while rendering, i.e. the frame can't be drawn a whole scanline at a time if this isn't 0 */
+    u32 MidScanlineWrites;
+    Nes_RasterEvent Events[NES_RASTER_LOG_SIZE];
+} Nes_RasterLog;
+
+/* see Nes_SetAudioStems */
+typedef enum Nes_AudioStem 
+{
+    NES_AUDIO_STEM_PULSE1 = 0,
+    NES_AUDIO_STEM_PULSE2,
+    NES_AUDIO_STEM_TRIANGLE,
+    NES_AUDIO_STEM_NOISE,
+    NES_AUDIO_STEM_DMC,
+    NES_AUDIO_STEM_COUNT,
+} Nes_AudioStem;
+
+/* see Nes_PlatformQueryAudioStats */
+typedef struct Nes_AudioStats 
+{
+    u32 Underruns;          /* times Nes_RenderAudio ran out of samples while the emulation was running */
+    u32 DeviceUnderruns;    /* times the platform's device ran out, see Nes_OnAudioDeviceStarved */
+    u32 Overruns;           /* times samples were thrown away because too many were already waiting */
+    u32 QueuedSamples;      /* waiting for Nes_RenderAudio right now */
+    /* what QueuedSamples is being steered toward, grows after underruns and slowly shrinks back 
+     * (but never past the latency budget, see Nes_SetAudioLatencyBudget) */
+    u32 TargetSamples;
+    u32 LatencyMs;          /* QueuedSamples plus the platform's buffers */
+    double CallbackIntervalMs;  /* average time between Nes_RenderAudio calls */
+    double CallbackJitterMs;    /* average difference between that and how long the samples they asked for last */
+} Nes_AudioStats;
 
 typedef u16 Nes_ControllerStatus;
 
@@ -67,14 +197,51 @@ typedef u16 Nes_ControllerStatus;
 isize Nes_PlatformQueryThreadContextSize(void);
 
 /* these functions can happen at any time (if Nes_PlatformQueryStaticBufferSize succeeds) */
+/* returns the latest complete frame, Data stays valid and unchanged until the next call, 
+ * never blocks the emulator, but must only be called from one thread */
 Platform_FrameBuffer Nes_PlatformQueryFrameBuffer(Platform_ThreadContext ThreadContext);
 void Nes_OnAudioFailed(Platform_ThreadContext ThreadContext);
-Nes_DisplayableStatus Nes_PlatformQueryDisplayableStatus(Platform_ThreadContext ThreadContext);
+/* debug view: each returns the current version of its section and only copies the section into *Out 
+ * when that differs from KnownVersion (the version returned by the previous call, 0 the first time), 
+ * versions are never 0. Must only be called from one thread */
+u32 Nes_PlatformQueryDebugRegisters(Platform_ThreadContext ThreadContext, u32 KnownVersion, Nes_DebugRegisters *Out);
+u32 Nes_PlatformQueryDebugPalette(Platform_ThreadContext ThreadContext, u32 KnownVersion, Nes_DebugPalette *Out);
+u32 Nes_PlatformQueryDebugPatternTables(Platform_ThreadContext ThreadContext, u32 KnownVersion, Nes_DebugPatternTables *Out);
+u32 Nes_PlatformQueryDebugDisassembly(Platform_ThreadContext ThreadContext, u32 KnownVersion, Nes_DebugDisassembly *Out);
+/* the emulator only saves what these are drawn from while they are being called, 
+ * it starts after the first call to one of them and stops a few frames after the last one */
+u32 Nes_PlatformQueryDebugNametables(Platform_ThreadContext ThreadContext, u32 KnownVersion, Nes_DebugNametables *Out);
+u32 Nes_PlatformQueryDebugAttributes(Platform_ThreadContext ThreadContext, u32 KnownVersion, Nes_DebugAttributes *Out);
+u32 Nes_PlatformQueryDebugSprites(Platform_ThreadContext ThreadContext, u32 KnownVersion, Nes_DebugSprites *Out);
+/* the log of the latest complete frame (only after Nes_SetRasterRecorder), 
+ * returns its FrameNumber and only copies it into *Out when that differs from KnownFrameNumber, 
+ * returns 0 if there is no complete frame yet */
+u32 Nes_PlatformQueryRasterLog(Platform_ThreadContext ThreadContext, u32 KnownFrameNumber, Nes_RasterLog *Out);
+/* can be called from any thread */
+Nes_AudioStats Nes_PlatformQueryAudioStats(Platform_ThreadContext ThreadContext);
+/* the oldest Count (at most) samples of Stem waiting to be read (see Nes_SetAudioStems), returns how many were read. 
+ * A reader that falls more than ~40ms behind (or only just started reading) gets the newest Count instead, 
+ * never blocks the emulator, each stem must only be read from one thread */
+u32 Nes_ReadAudioStem(Platform_ThreadContext ThreadContext, Nes_AudioStem Stem, int16_t *Out, u32 Count);
+/* every access as CSV (frame,clk,scanline,dot,register,value,access) */
+isize Nes_FormatRasterLogCSV(const Nes_RasterLog *Log, char *Buffer, isize BufferSize);
+/* the mid-scanline write count and the line and dot of every $2005 and $2006 write */
+isize Nes_FormatRasterTimeline(const Nes_RasterLog *Log, char *Buffer, isize BufferSize);
 
 
 /* functions for the emulator to request information from the platform */
 double Platform_GetTimeMillisec(void);
 Nes_ControllerStatus Platform_GetControllerState(void);
+/* called (only after Nes_SetScanlineBand) on the thread running the PPU as soon as a band of scanlines is drawn, 
+ * Band.Data points to FirstScanline's first pixel and is only valid during the call */
+void Platform_OnScanlinesCompleted(Platform_FrameBuffer Band, u32 FirstScanline);
+/* atomically stores Value in *Dst and returns the old value, must act as a full memory barrier */
+u32 Platform_AtomicExchange(volatile u32 *Dst, u32 Value);
+/* atomically adds Value to *Dst and returns the old value, must act as a full memory barrier */
+u32 Platform_AtomicAdd(volatile u32 *Dst, u32 Value);
+/* called on whichever thread calls Nes_PlatformQueryFrameBuffer when a frame is waiting to be scaled (or NTSC filtered), 
+ * and on the one calling Nes_PlatformQueryDebugNametables when the nametables are about to be drawn, any thread in Nes_OnScalerLoop should be woken up to help */
+void Platform_OnScalerJob(void);
 
 
 /* functions for the emulator to work in */
@@ -82,17 +249,74 @@ Nes_ControllerStatus Platform_GetControllerState(void);
  * only called when the platform was able to create a buffer that has 
  * the size requested by Nes_PlatformQueryStaticBufferSize */
 Platform_AudioConfig Nes_OnEntry(Platform_ThreadContext ThreadContext);
+/* should be called over and over on a thread of its own (the emulator thread), ElapsedTime in milliseconds, 
+ * emulates up to ElapsedTime and hands the audio over to Nes_RenderAudio as it goes, 
+ * calling it more often (every ms or so) keeps the audio latency down */
 void Nes_OnLoop(Platform_ThreadContext ThreadContext, double ElapsedTime);
 void Nes_AtExit(Platform_ThreadContext ThreadContext);
-/* event handlers (can be called at any time after Nes_OnEntry)  */
+/* should be called over and over on yet another thread (the PPU thread) for as long as Nes_SetPPUThread is on 
+ * and the emulator thread is running, steps the PPU through the register writes the emulator thread has handed it, 
+ * returns false if there was nothing to do */
+Bool8 Nes_OnPPULoop(Platform_ThreadContext ThreadContext);
+/* optional, can be called on any number of threads (the scaler workers) after Platform_OnScalerJob, 
+ * helps scale (or NTSC filter) the frame Nes_PlatformQueryFrameBuffer is waiting on 
+ * and draw the nametables Nes_PlatformQueryDebugNametables is waiting on, returns false if there was nothing to do */
+Bool8 Nes_OnScalerLoop(Platform_ThreadContext ThreadContext);
+/* event handlers (can be called at any time after Nes_OnEntry, from one thread at a time), 
+ * the ones that change the nes itself (a reset, a new cartridge, the PPU's settings) are only handed to the emulator thread, 
+ * they take effect at the start of the next Nes_OnLoop or between two of its 1ms chunks */
 void Nes_OnAudioInitializationFailed(Platform_ThreadContext ThreadContext);
-int16_t Nes_OnAudioSampleRequest(Platform_ThreadContext ThreadContext, double t);
+/* writes FrameCount frames of whatever audio Nes_OnLoop has produced so far to Out, 
+ * the same sample in every one of the ChannelCount interleaved channels. 
+ * Never blocks or emulates anything, safe to call from the audio thread while Nes_OnLoop runs */
+void Nes_RenderAudio(Platform_ThreadContext ThreadContext, int16_t *Out, u32 FrameCount, u32 ChannelCount);
+/* the platform's audio device played everything it was given and went quiet, called from the audio thread */
+void Nes_OnAudioDeviceStarved(Platform_ThreadContext ThreadContext);
 void Nes_OnEmulatorToggleHalt(Platform_ThreadContext ThreadContext);
 void Nes_OnEmulatorTogglePalette(Platform_ThreadContext ThreadContext);
 void Nes_OnEmulatorReset(Platform_ThreadContext ThreadContext);
 void Nes_OnEmulatorSingleStep(Platform_ThreadContext ThreadContext);
 void Nes_OnEmulatorSingleFrame(Platform_ThreadContext ThreadContext);
-/* returns NULL on success, or a static error string on failure (no lifetime) */
+/* makes the PPU draw straight into Data (Pitch bytes between rows, at least NES_SCREEN_WIDTH pixels wide, 
+ * NES_SCREEN_HEIGHT rows) instead of its own buffers, NULL goes back to its own buffers. 
+ * Data is drawn into continuously, Nes_PlatformQueryFrameBuffer's Sequence or Platform_OnScanlinesCompleted 
+ * tell when (part of) a frame is complete. Should only be called when the emulation is halted, 
+ * waits for the emulator thread to pick up the last call first */
+void Nes_SetFrameBufferTarget(Platform_ThreadContext ThreadContext, void *Data, isize Pitch, Nes_PixelFormat PixelFormat);
+/* frames returned by Nes_PlatformQueryFrameBuffer go through Scaler first (on the thread that queries them), 
+ * has no effect when drawing into a target set by Nes_SetFrameBufferTarget */
+void Nes_SetScaler(Platform_ThreadContext ThreadContext, Nes_Scaler Scaler);
+/* frames returned by Nes_PlatformQueryFrameBuffer are decoded from a simulated NTSC signal instead 
+ * (twice as wide, takes precedence over the scaler), has no effect when drawing into a target */
+void Nes_SetNTSCFilter(Platform_ThreadContext ThreadContext, Bool8 Enable);
+/* calls Platform_OnScanlinesCompleted every ScanlinesPerBand scanlines (0 disables it) */
+void Nes_SetScanlineBand(Platform_ThreadContext ThreadContext, u32 ScanlinesPerBand);
+/* runs the PPU on the PPU thread (see Nes_OnPPULoop) instead of the emulator thread, off until this is called. 
+ * Register writes are handed over instead of done on the spot, the emulator thread only waits for the PPU 
+ * when the cpu reads from it, writes PPUCTRL or the cartridge, or when NMI or the end of a frame is due. 
+ * Takes effect on the next Nes_OnLoop */
+void Nes_SetPPUThread(Platform_ThreadContext ThreadContext, Bool8 Enable);
+/* only 1 out of every SkippedFrames + 1 frames is drawn and presented (0 draws every frame), 
+ * skipped frames are still fully emulated (sprite 0 hit, NMI timing, mapper-visible fetches) */
+void Nes_SetFrameSkip(Platform_ThreadContext ThreadContext, u32 SkippedFrames);
+/* logs every cpu read and write of the PPU registers, a frame at a time, see Nes_PlatformQueryRasterLog. 
+ * PPUSTATUS reads skipped by the idle loop detection are not logged */
+void Nes_SetRasterRecorder(Platform_ThreadContext ThreadContext, Bool8 Enable);
+/* Nes_RenderAudio renders at SampleRate from now on (NES_DEFAULT_AUDIO_SAMPLE_RATE until this is called), 
+ * the emulation speed and pitch stay exact at any rate. Should only be called when neither the audio 
+ * nor Nes_OnLoop are running */
+void Nes_SetAudioSampleRate(Platform_ThreadContext ThreadContext, u32 SampleRate);
+/* the most audio latency (what's waiting for Nes_RenderAudio plus the buffers in the config returned by Nes_OnEntry) 
+ * the emulator will go up to when it has to back off after underruns, 
+ * NES_DEFAULT_AUDIO_LATENCY_MS until this is called */
+void Nes_SetAudioLatencyBudget(Platform_ThreadContext ThreadContext, u32 Milliseconds);
+/* produces every channel of the APU on its own too, at the same rate and in step with Nes_RenderAudio's samples, 
+ * for oscilloscopes and such (see Nes_ReadAudioStem), a channel's stem is what it would sound like 
+ * if the others were silent. Unread samples are pushed out by newer ones, the newest 170ms or so are kept, 
+ * and turning them back on starts over from nothing */
+void Nes_SetAudioStems(Platform_ThreadContext ThreadContext, Bool8 Enable);
+/* returns NULL on success, or a static error string on failure (no lifetime), 
+ * the cartridge replaces the current one on the emulator thread (waits for it to pick up the last one first) */
 const char *Nes_ParseINESFile(Platform_ThreadContext ThreadContext, const void *FileBuffer, isize BufferSizeBytes);
 
 
@@ -19,6 +19,10 @@ isize AppendString(char *Buffer, isize BufferSize, isize At, const char *String)
      * from the least significant digit, this is a feature and not a bug */
 isize AppendHex(char *Buffer, isize BufferSize, isize At, int DigitCount, u32 Hex);
 
+/* appends a signed decimal number to the buffer at a given index 'At', 
+ * string will be truncated if the buffer does not have enough room */
+isize AppendDecimal(char *Buffer, isize BufferSize, isize At, i64 Decimal);
+
 /*
  * BufferSize must not be zero and Bufer must be valid 
  * returns the bytes written - 1, always less than BufferSize
@@ -26,6 +30,7 @@ isize AppendHex(char *Buffer, isize BufferSize, isize At, int DigitCount, u32 He
  *      {x<number>}: appends a hexadecimal number to the string buffer,
  *                  ensures that there are at least <number> amount of digits printed
  *      {s}: copy the argument string to the string buffer
+ *      {d}: appends a decimal number to the string buffer, the argument must be an i64
  * example usage: 
  *   FormatString(Buf, BufSize, 
  *       "hex: {x4} {x3}\n", 0xdead, 0xbeef,
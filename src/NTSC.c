@@ -0,0 +1,205 @@
+#ifndef NES_NTSC_C
+#define NES_NTSC_C
+
+/*
+ * NTSC composite video filter: turns the PPU's color indices (and emphasis bits)
+ * into the signal the real PPU would output, and decodes that back into RGB like a TV would,
+ * which gives the color bleeding, dot crawl and all that good stuff.
+ * The signal generation and decoding is from https://www.nesdev.org/wiki/NTSC_video
+ */
+
+#include "Common.h"
+#include "Utils.h"
+#include "Nes.h"
+#include "Scaler.c"
+
+
+#define NTSC_SAMPLES_PER_PIXEL 8
+#define NTSC_PHASES 12      /* samples per color subcarrier cycle */
+#define NTSC_DECODE_WINDOW 12
+#define NTSC_HUE_OFFSET 4   /* in phases (30 degrees each), lines the hues up with sPPURGBPalette */
+#define NTSC_COLOR_COUNT (1 << 9) /* 0b eee cccccc */
+#define NES_NTSC_OUTPUT_WIDTH (NES_SCREEN_WIDTH * 2)
+#define NTSC_SAMPLES_PER_SCANLINE (NES_SCREEN_WIDTH * NTSC_SAMPLES_PER_PIXEL)
+#define NTSC_SAMPLES_PER_OUTPUT_PIXEL (NTSC_SAMPLES_PER_SCANLINE / NES_NTSC_OUTPUT_WIDTH)
+
+/* padded to 4 floats so that a sample is exactly one SSE register */
+typedef struct NESNTSC_Sample
+{
+    float Y, I, Q, Pad;
+} NESNTSC_Sample;
+
+/* a frame being filtered, see NESNTSC_RunPooled */
+typedef struct NESNTSC_Job
+{
+    u32 *Dst;
+    const void *Src;
+    isize SrcPitch;
+    u32 FrameNumber;
+} NESNTSC_Job;
+
+/* contribution of one sample of a given color at a given phase to the decoded Y, I and Q,
+ * so decoding becomes a sum of table entries */
+static NESNTSC_Sample sNTSCKernel[NTSC_COLOR_COUNT][NTSC_PHASES];
+static Bool8 sNTSCKernelInitialized = false;
+
+
+static float NESNTSC_Signal(uint Color, uint Phase)
+{
+    /* voltage levels, relative to sync */
+    static const float Black = .518f, White = 1.962f, Attenuation = .746f;
+    static const float Levels[8] = {
+        .350f, .518f, .962f, 1.550f,    /* signal low */
+        1.094f, 1.506f, 1.962f, 1.962f, /* signal high */
+    };
+
+    uint Hue = Color & 0x0F;
+    uint Level = (Color >> 4) & 0x3;
+    uint Emphasis = Color >> 6;
+    if (Hue > 13) /* forced level 1 */
+        Level = 1;
+
+    /* the signal is a square wave between these 2 levels */
+    float Low = Levels[0 + Level];
+    float High = Levels[4 + Level];
+    if (Hue == 0)
+        Low = High;
+    if (Hue > 12)
+        High = Low;
+
+#define IN_COLOR_PHASE(Hue_) (((Hue_) + Phase) % NTSC_PHASES < 6)
+    float Signal = IN_COLOR_PHASE(Hue)? High : Low;
+    if (((Emphasis & 1) && IN_COLOR_PHASE(0))
+    || ((Emphasis & 2) && IN_COLOR_PHASE(4))
+    || ((Emphasis & 4) && IN_COLOR_PHASE(8)))
+    {
+        Signal *= Attenuation;
+    }
+#undef IN_COLOR_PHASE
+
+    return (Signal - Black) / (White - Black);
+}
+
+/* not thread safe, done before any band of a frame is handed out */
+static void NESNTSC_InitKernel(void)
+{
+    if (sNTSCKernelInitialized)
+        return;
+
+    /* cos and sin of (pi * Phase / 6) */
+    static const float Cos[NTSC_PHASES] = {
+        1, .8660254f, .5f, 0, -.5f, -.8660254f, -1, -.8660254f, -.5f, 0, .5f, .8660254f,
+    };
+    static const float Sin[NTSC_PHASES] = {
+        0, .5f, .8660254f, 1, .8660254f, .5f, 0, -.5f, -.8660254f, -1, -.8660254f, -.5f,
+    };
+    for (uint Color = 0; Color < NTSC_COLOR_COUNT; Color++)
+    {
+        for (uint Phase = 0; Phase < NTSC_PHASES; Phase++)
+        {
+            float Level = NESNTSC_Signal(Color, Phase) / NTSC_DECODE_WINDOW;
+            uint DecodePhase = (Phase + NTSC_HUE_OFFSET) % NTSC_PHASES;
+            sNTSCKernel[Color][Phase] = (NESNTSC_Sample) {
+                .Y = Level,
+                .I = Level * Cos[DecodePhase],
+                .Q = Level * Sin[DecodePhase],
+            };
+        }
+    }
+    sNTSCKernelInitialized = true;
+}
+
+static u32 NESNTSC_YIQToRGB(float Y, float I, float Q)
+{
+    float Rgb[3] = {
+        Y + 0.946882f*I + 0.623557f*Q,
+        Y - 0.274788f*I - 0.635691f*Q,
+        Y - 1.108545f*I + 1.709007f*Q,
+    };
+    u32 Color = 0;
+    for (uint i = 0; i < 3; i++)
+    {
+        float Channel = Rgb[i] * 255.0f;
+        if (Channel < 0)
+            Channel = 0;
+        if (Channel > 255)
+            Channel = 255;
+        Color = (Color << 8) | (u32)Channel;
+    }
+    return Color;
+}
+
+static void NESNTSC_RunBand(void *Job, uint FirstRow, uint RowCount)
+{
+    const NESNTSC_Job *This = Job;
+
+    /* one per band so that bands can be filtered at the same time,
+     * padded with black on both sides for the decoding window */
+    NESNTSC_Sample Samples[NTSC_DECODE_WINDOW + NTSC_SAMPLES_PER_SCANLINE];
+    NESNTSC_Sample *Scanline = Samples + NTSC_DECODE_WINDOW/2;
+    Memset(Samples, 0, sizeof Samples);
+
+    for (uint y = FirstRow; y < FirstRow + RowCount; y++)
+    {
+        /* 341 dots * 8 samples per scanline, that's 4 phases off every scanline and every frame (262 scanlines) */
+        uint Phase = (This->FrameNumber * 4 + y * 4) % NTSC_PHASES;
+
+        /* encode */
+        const u16 *SrcRow = (const u16 *)((const u8 *)This->Src + y*This->SrcPitch);
+        for (uint x = 0; x < NES_SCREEN_WIDTH; x++)
+        {
+            const NESNTSC_Sample *Kernel = sNTSCKernel[SrcRow[x] % NTSC_COLOR_COUNT];
+            for (uint i = 0; i < NTSC_SAMPLES_PER_PIXEL; i++)
+            {
+                Scanline[x*NTSC_SAMPLES_PER_PIXEL + i] = Kernel[Phase];
+                Phase = Phase + 1 == NTSC_PHASES? 0 : Phase + 1;
+            }
+        }
+
+        /* decode */
+        u32 *DstRow = This->Dst + y*NES_NTSC_OUTPUT_WIDTH;
+        for (uint x = 0; x < NES_NTSC_OUTPUT_WIDTH; x++)
+        {
+            const NESNTSC_Sample *Window = Samples + x*NTSC_SAMPLES_PER_OUTPUT_PIXEL;
+#ifdef NES_SCALER_SSE2
+            /* Y, I and Q summed side by side, same order of additions as below so the result is the same */
+            __m128 Sum = _mm_setzero_ps();
+            for (uint i = 0; i < NTSC_DECODE_WINDOW; i++)
+                Sum = _mm_add_ps(Sum, _mm_loadu_ps(&Window[i].Y));
+            float YIQ[4];
+            _mm_storeu_ps(YIQ, Sum);
+            DstRow[x] = NESNTSC_YIQToRGB(YIQ[0], YIQ[1], YIQ[2]);
+#else
+            float Y = 0, I = 0, Q = 0;
+            for (uint i = 0; i < NTSC_DECODE_WINDOW; i++)
+            {
+                Y += Window[i].Y;
+                I += Window[i].I;
+                Q += Window[i].Q;
+            }
+            DstRow[x] = NESNTSC_YIQToRGB(Y, I, Q);
+#endif
+        }
+    }
+}
+
+/*
+ * Src: NES_PIXELFORMAT_PALETTE_INDEX frame, SrcPitch bytes between rows
+ * Dst: XRGB8888, NES_NTSC_OUTPUT_WIDTH x NES_SCREEN_HEIGHT
+ * FrameNumber: the phase of the signal shifts every frame
+ * filtered in bands of rows on Pool, see NESScaler_RunJob
+ */
+void NESNTSC_RunPooled(NESScalerPool *Pool, u32 *Dst, const void *Src, isize SrcPitch, u32 FrameNumber)
+{
+    NESNTSC_InitKernel();
+
+    NESNTSC_Job Job = {
+        .Dst = Dst,
+        .Src = Src,
+        .SrcPitch = SrcPitch,
+        .FrameNumber = FrameNumber,
+    };
+    NESScaler_RunJob(Pool, NESNTSC_RunBand, &Job, NES_SCREEN_HEIGHT);
+}
+
+#endif /* NES_NTSC_C */
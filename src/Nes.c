@@ -12,8 +12,24 @@
 #include "PPU.c"
 #include "Cartridge.c"
 #include "APU.c"
+#include "Scaler.c"
+#include "NTSC.c"
+#include "PPUViewer.c"
+#include "RasterRecorder.c"
+#include "AudioRing.c"
+#include "PPUQueue.c"
 
 
+/* cpu state at the last PPUSTATUS read, used to detect a cpu that does nothing but poll it */
+typedef struct NESStatusPoll 
+{
+    u64 Clk;
+    u16 PC;
+    u8 A, X, Y, SP, Flags;
+    u8 Value;
+    Bool8 Valid;
+} NESStatusPoll;
+
 typedef struct NES 
 {
     NESCartridge *Cartridge;
@@ -28,10 +44,68 @@ typedef struct NES
     u16 DMASaveAddr;
     u8 DMAData;
 
+    NESStatusPoll StatusPoll;
+    u32 CPUSkipCycles;
+    u32 CPUSkipPeriod; /* cycles, how long an iteration of the polling loop being skipped takes */
+
+    /* the PPU is run lazily, see NesInternal_SyncPPU */
+    u64 PPUClk;
+    u64 PPUSyncClk;
+    Bool8 PPUFrameCompleted;
+    /* NULL unless the PPU runs on the PPU thread, see Nes_SetPPUThread */
+    NESPPUQueue *PPUQueue;
+
+    /* the DMC's sample fetches are scheduled ahead of time (see NesInternal_ScheduleDMC), 
+     * they take the bus away from the cpu for a few cycles */
+    u64 DMCFetchClk;
+    u32 DMCStallCycles;
+    Bool8 APUIRQ;
+
+    /* the earliest of PPUSyncClk and DMCFetchClk, the only thing checked every clk */
+    u64 EventClk;
+
+    /* NULL unless recording, see Nes_SetRasterRecorder */
+    NESRasterRecorder *RasterRecorder;
+
+    /* bumped on anything that could change what the cpu sees in the cartridge (bank switches) */
+    u32 CartridgeVersion;
+
     u8 ControllerStatusBuffer;
     u8 Ram[NES_CPU_RAM_SIZE];
 } NES;
 
+/* a section of the debug view, Version changes along with its contents, 
+ * Key is what the contents were computed from */
+typedef struct NESDebugSection 
+{
+    u32 Version;
+    u32 Key[4];
+} NESDebugSection;
+
+typedef struct NESDebugView 
+{
+    NESDebugSection RegistersSection;
+    NESDebugSection PaletteSection;
+    NESDebugSection PatternTablesSection;
+    NESDebugSection DisassemblySection;
+    Nes_DebugRegisters Registers;
+    Nes_DebugPalette Palette;
+    Nes_DebugPatternTables PatternTables;
+    Nes_DebugDisassembly Disassembly;
+
+    /* the latest PPU snapshot, the version only changes when its contents do */
+    NESDebugSection SnapshotSection;
+    NESPPU_Snapshot Snapshot;
+    NESDebugSection TileCacheSection;
+    NESPPUViewer_TileCache TileCache;
+    NESDebugSection NametablesSection;
+    NESDebugSection AttributesSection;
+    NESDebugSection SpritesSection;
+    Nes_DebugNametables Nametables;
+    Nes_DebugAttributes Attributes;
+    Nes_DebugSprites Sprites;
+} NESDebugView;
+
 typedef enum NESEmulationMode 
 {
     EMUMODE_SINGLE_STEP,
@@ -52,20 +126,278 @@ typedef struct Emulator
     NESEmulationMode EmulationMode;
     Bool8 EmulationHalted;
     Bool8 EmulationDone;
-    double ResidueTime;
-    u32 MasterClkPerAudioSample;
 
-    /* screen */
-    u32 ScreenBuffer[2][NES_SCREEN_BUFFER_SIZE];
-    u32 (*BackBuffer)[NES_SCREEN_BUFFER_SIZE];
-    u32 (*FrontBuffer)[NES_SCREEN_BUFFER_SIZE];
+    /* the other threads never change the nes while Nes_OnLoop could be running it, 
+     * they leave an EMU_COMMAND_* in here and the emulator thread does it between chunks (see NesInternal_RunCommands). 
+     * A command's arguments belong to the thread that asks until its bit is set, 
+     * and to the emulator thread until the bit is cleared again */
+    volatile u32 PendingCommands;
+    NESCartridge NewCartridge;
+
+    /* real time pacing: EmulatedClk master clks have been run since TimeOrigin (see Nes_OnLoop) */
+    double TimeOrigin;
+    u64 EmulatedClk;
+
+    /* audio: the emulator thread resamples into AudioRing (see NesInternal_ProduceAudio), 
+     * the audio thread drains it (Nes_RenderAudio) */
+    NESAudioRing AudioRing;
+    /* set once the emulator thread has written anything to AudioRing, 
+     * the audio thread starts first and running dry before that isn't an underrun */
+    volatile Bool8 AudioStarted;
+    u32 AudioSampleRate;
+    u32 AudioRingTarget;
+    u32 AudioDeviceFrames; /* buffered on the platform's side, from the config returned by Nes_OnEntry */
+    /* adaptive latency (see NesInternal_AdaptAudioLatency), emulator thread only */
+    u32 AudioLatencyBudget; /* ms */
+    u32 AudioUnderrunsSeen;
+    u32 AudioSamplesSinceUnderrun;
+    /* audio thread only */
+    i16 LastAudioSample;
+    u32 LastAudioRequestFrames;
+    double LastAudioRequestTime;
+    /* what the adaptive latency needs from the audio thread, published with Platform_AtomicExchange like AudioRing's indices */
+    volatile u32 AudioRequestFrames;
+    volatile u32 AudioCallbackJitterUs;
+    /* every counter in here is only ever written by one thread */
+    Nes_AudioStats AudioStats;
+    /* per channel taps, the emulator thread starts and stops them when it sees AudioStemsRequested change */
+    volatile Bool8 AudioStemsRequested;
+    NESAudioRing AudioStems[NES_AUDIO_STEM_COUNT];
+
+    /* screen: triple buffered so that neither the emulator nor the presenter ever waits on the other, 
+     * the back buffer belongs to the emulator, the front buffer to the presenter, 
+     * and LatestFrame (the only thing both touch) holds the index of the 3rd one */
+    u32 ScreenBuffer[3][NES_SCREEN_BUFFER_SIZE];
+    u32 ScreenBufferSequence[3];
+    u64 ScreenBufferHash[3];
+    Bool8 ScreenBufferHashIsValid[3];
+    /* what the PPU drew each buffer in, frames drawn before an NTSC filter switch keep their old format */
+    Nes_PixelFormat ScreenBufferFormat[3];
+    /* the back buffer has pixels of both formats in it, see NesInternal_UpdateScreenOutput */
+    Bool8 ScreenBufferFormatChanged;
+    u32 FrameSequence;
+    u32 BackBufferIndex;
+    u32 FrontBufferIndex;
+    volatile u32 LatestFrame; /* buffer index | SCREEN_BUFFER_NEW */
+
+    /* the front buffer after going through the NTSC filter or Scaler, 
+     * only touched by the presenter (see Nes_PlatformQueryFrameBuffer) */
+    Nes_Scaler Scaler;
+    Bool8 FilteredScreenIsValid;
+    u32 FilteredScreenSequence;
+    u64 FilteredScreenHash; /* of the frame before filtering */
+    Bool8 FilteredScreenHashIsValid;
+    u32 FilteredScreen[NES_SCREEN_BUFFER_SIZE * NES_SCALER_MAX_FACTOR * NES_SCALER_MAX_FACTOR];
+    /* the scaler workers help the presenter with it, see Nes_OnScalerLoop */
+    NESScalerPool ScalerPool;
+
+    /* set by Nes_SetFrameBufferTarget, replaces the buffers above, 
+     * these 3 are the presenter's and the arguments of EMU_COMMAND_SCREEN_TARGET */
+    void *TargetScreen;
+    isize TargetScreenPitch;
+    Nes_PixelFormat TargetScreenFormat;
+    /* the emulator's side of it */
+    Bool8 DrawingToTarget;
+    u64 TargetScreenHash;
+    Bool8 TargetScreenHashIsValid;
+
+    /* the emulator thread hands these to the PPU when it sees them change */
+    volatile Bool8 NTSCFilterEnabled;
+    volatile u32 FrameSkipRequested;
+    volatile u32 ScanlinesPerBandRequested;
+
+    /* PPU state for the nametable, attribute and sprite viewers, taken at the end of every frame 
+     * for as long as they keep being asked for, and triple buffered just like the screen */
+    NESPPU_Snapshot PPUSnapshot[3];
+    u32 PPUSnapshotBackIndex;
+    u32 PPUSnapshotFrontIndex;
+    volatile u32 LatestPPUSnapshot; /* index | SCREEN_BUFFER_NEW */
+    /* counted down every frame, set back to PPU_SNAPSHOT_LINGER_FRAMES every time a viewer is queried */
+    volatile u32 PPUSnapshotFramesLeft;
+    /* the ChrVersion and CartridgeVersion each snapshot's Chr was read at, 
+     * so that CHR is only read through the mapper again when one of them changed */
+    u32 PPUSnapshotChrKey[3][2];
+    Bool8 PPUSnapshotChrIsValid[3];
+    u32 PPUSnapshotLastIndex; /* the one taken last */
+
+    /* only touched by the thread that queries it (see Nes_PlatformQueryDebug*) */
+    NESDebugView DebugView;
+    /* the scaler workers help that thread draw the nametables, 
+     * a pool of its own since it doesn't have to be the presenter */
+    NESScalerPool DebugViewPool;
+
+    NESRasterRecorder RasterRecorder;
+    volatile Bool8 RasterRecorderRequested;
+
+    /* register writes on their way to the PPU thread, see Nes_OnPPULoop */
+    NESPPUQueue PPUQueue;
+    volatile Bool8 PPUThreadRequested;
 } Emulator;
 
+#define EMU_MAX_CATCHUP_CLK (NES_MASTER_CLK / 10)
+#define EMU_AUDIO_CHUNK_CLK (NES_MASTER_CLK / 1000)
+#define AUDIO_MAX_RATE_ADJUSTMENT .005
+#define AUDIO_DEVICE_BUFFER_FRAMES 256
+#define AUDIO_DEVICE_BUFFER_COUNT 3
+#define AUDIO_INITIAL_TARGET_MS 10
+#define AUDIO_STEM_MAX_BACKLOG (AUDIO_RING_SIZE / 4) /* ~40ms, a stem reader further behind skips ahead */
+#define DMC_FETCH_STALL_CYCLES 4
+/* the OAM DMA already has the bus, the DMC only has to wait for its turn in it */
+#define DMC_FETCH_STALL_CYCLES_DURING_OAM_DMA 2
+#define SCREEN_BUFFER_NEW 0x80000000
+#define PPU_SNAPSHOT_LINGER_FRAMES 8 /* PPU snapshots stop this many frames after the viewers stop being queried */
+
+#define EMU_COMMAND_RESET           (1 << 0)
+#define EMU_COMMAND_CARTRIDGE       (1 << 1) /* connects NewCartridge */
+#define EMU_COMMAND_SCREEN_TARGET   (1 << 2) /* draws into TargetScreen */
+
+
+/* on the thread asking, only one thread at a time can ask for commands, 
+ * waits until the emulator thread is done with the last Command, then its arguments can be written */
+static void NesInternal_WaitForCommand(Emulator *Emu, u32 Command)
+{
+    while (Emu->PendingCommands & Command)
+    {
+    }
+    /* full barrier, the arguments are only written after the emulator thread is seen to be done with them */
+    Platform_AtomicAdd(&Emu->PendingCommands, 0);
+}
+
+/* on the thread asking, after NesInternal_WaitForCommand and writing the arguments */
+static void NesInternal_PostCommand(Emulator *Emu, u32 Command)
+{
+    Platform_AtomicAdd(&Emu->PendingCommands, Command);
+}
 
 
+
+/* on whichever thread runs the PPU */
+static void NesInternal_StepPPU(NES *Nes, u64 Clk)
+{
+    while (Nes->PPUClk < Clk)
+    {
+        Nes->PPUClk++;
+        Bool8 FrameCompleted = NESPPU_StepClock(&Nes->PPU);
+        if (FrameCompleted && Nes->RasterRecorder)
+            NESRaster_EndFrame(Nes->RasterRecorder);
+        Nes->PPUFrameCompleted |= FrameCompleted;
+    }
+}
+
+/* on whichever thread runs the PPU, once it's caught up to Clk */
+static void NesInternal_ApplyPPUWrite(NES *Nes, u64 Clk, u16 Address, u8 Byte)
+{
+    /* OAM DMA writes come in as just the register, they're not the cpu's */
+    if (Nes->RasterRecorder && Address >= 0x2000)
+        NESRaster_Record(Nes->RasterRecorder, &Nes->PPU, Clk, Address, Byte, true);
+    NESPPU_ExternalWrite(&Nes->PPU, Address & 0x07, Byte);
+}
+
+static void NesInternal_SyncPPU(NES *Nes)
+{
+    /* 
+     * the PPU only affects the rest of the nes through NMI, the end of a frame and what the cpu reads from it, 
+     * so instead of stepping it in lockstep with the cpu, it's only caught up to the current clk 
+     * when the cpu touches it (or anything it fetches from) and when NMI or the end of a frame is due, 
+     * which gives the exact same result while running it in long uninterrupted batches 
+     */
+    if (Nes->PPUQueue)
+    {
+        /* the PPU thread does the catching up, once it's done with everything it sits idle 
+         * and the PPU can be looked at (and NMI and the end of a frame have happened) */
+        while (!NESPPUQueue_Push(Nes->PPUQueue, Nes->Clk, PPU_QUEUE_SYNC, 0))
+        {
+        }
+        NESPPUQueue_WaitUntilEmpty(Nes->PPUQueue);
+    }
+    else
+    {
+        NesInternal_StepPPU(Nes, Nes->Clk);
+    }
+
+    uint Dots = NESPPU_PredictVBlank(&Nes->PPU);
+    uint FrameCompletion = NESPPU_PredictFrameCompletion(&Nes->PPU);
+    uint ScanlineCallback = NESPPU_PredictScanlineCallback(&Nes->PPU);
+    if (FrameCompletion < Dots)
+        Dots = FrameCompletion;
+    if (ScanlineCallback < Dots)
+        Dots = ScanlineCallback;
+    Nes->PPUSyncClk = Nes->PPUClk + Dots + 1;
+    Nes->EventClk = Nes->PPUSyncClk < Nes->DMCFetchClk? Nes->PPUSyncClk : Nes->DMCFetchClk;
+}
+
+/* writes that don't have to be seen right away go to the PPU thread when there is one */
+static void NesInternal_WritePPU(NES *Nes, u16 Address, u8 Byte)
+{
+    /* except PPUCTRL, which can raise NMI on the spot */
+    if (Nes->PPUQueue && (Address & 0x07) != PPU_CTRL)
+    {
+        /* the PPU thread is a whole queue behind, it'll catch up */
+        while (!NESPPUQueue_Push(Nes->PPUQueue, Nes->Clk, Address, Byte))
+        {
+        }
+        return;
+    }
+    NesInternal_SyncPPU(Nes);
+    NesInternal_ApplyPPUWrite(Nes, Nes->Clk, Address, Byte);
+}
+
+/* after anything that could have changed when the DMC needs its next byte or its IRQ, the APU has to be caught up */
+static void NesInternal_ScheduleDMC(NES *Nes)
+{
+    Nes->DMCFetchClk = NESAPU_NextDMCFetch(&Nes->APU);
+    Nes->APUIRQ = NESAPU_IRQ(&Nes->APU);
+    Nes->EventClk = Nes->PPUSyncClk < Nes->DMCFetchClk? Nes->PPUSyncClk : Nes->DMCFetchClk;
+
+    /* the IRQ can't wait until the cpu is done skipping through a PPUSTATUS poll (see NesInternal_OnStatusPoll), 
+     * stop skipping at the end of the iteration of the loop it's in, the cpu's state is the same there */
+    if (Nes->APUIRQ && Nes->CPUSkipCycles && !MC6502_FlagGet(Nes->CPU.Flags, FLAG_I))
+        Nes->CPUSkipCycles %= Nes->CPUSkipPeriod;
+}
+
+static void NesInternal_OnStatusPoll(NES *Nes, u8 Value)
+{
+    NESStatusPoll Poll = {
+        .Clk = Nes->Clk,
+        .PC = Nes->CPU.PC,
+        .A = Nes->CPU.A,
+        .X = Nes->CPU.X,
+        .Y = Nes->CPU.Y,
+        .SP = Nes->CPU.SP,
+        .Flags = Nes->CPU.Flags,
+        .Value = Value,
+        .Valid = true,
+    };
+    NESStatusPoll *Last = &Nes->StatusPoll;
+
+    /* 
+     * nothing was written and no other IO was read since the last PPUSTATUS read, 
+     * and the cpu is back to the exact same state and read the exact same value: 
+     * it's in a loop that will keep doing the same thing every Period clks 
+     * until PPUSTATUS changes, so don't bother running the cpu until right before that 
+     */
+    if (Last->Valid 
+    && Last->PC == Poll.PC 
+    && Last->A == Poll.A && Last->X == Poll.X && Last->Y == Poll.Y 
+    && Last->SP == Poll.SP && Last->Flags == Poll.Flags 
+    && Last->Value == Poll.Value)
+    {
+        u64 Period = Poll.Clk - Last->Clk;
+        /* the first clk at which a PPUSTATUS read sees the change */
+        u64 EventClk = Nes->Clk + NESPPU_PredictNextStatusEvent(&Nes->PPU) + 1;
+        u64 SkippedReads = (EventClk - 1 - Poll.Clk) / Period;
+
+        Nes->CPUSkipCycles = SkippedReads * Period / 3;
+        Nes->CPUSkipPeriod = Period / 3;
+        Poll.Clk += SkippedReads * Period;
+    }
+    *Last = Poll;
+}
+
 static void NesInternal_WriteByte(void *UserData, u16 Address, u8 Byte)
 {
     NES *Nes = UserData;
+    Nes->StatusPoll.Valid = false;
 
     /* ram range */
     if (Address < 0x2000)
@@ -76,7 +408,7 @@ static void NesInternal_WriteByte(void *UserData, u16 Address, u8 Byte)
     /* IO registers: PPU */
     else if (IN_RANGE(0x2000, Address, 0x3FFF))
     {
-        NESPPU_ExternalWrite(&Nes->PPU, Address & 0x07, Byte);
+        NesInternal_WritePPU(Nes, Address, Byte);
     }
     /* controller capture */
     else if (Address == 0x4016)
@@ -95,7 +427,9 @@ static void NesInternal_WriteByte(void *UserData, u16 Address, u8 Byte)
     else if (IN_RANGE(0x4000, Address, 0x4013) 
     || Address == 0x4015 || Address == 0x4017)
     {
+        NESAPU_CatchUp(&Nes->APU, Nes->Clk);
         NESAPU_ExternalWrite(&Nes->APU, Address, Byte);
+        NesInternal_ScheduleDMC(Nes);
     }
     /* Expansion Rom */
     else if (IN_RANGE(0x4020, Address, 0x5FFF))
@@ -106,7 +440,16 @@ static void NesInternal_WriteByte(void *UserData, u16 Address, u8 Byte)
     /* Cartridge ROM */
     else if (Nes->Cartridge)
     {
+        /* could be a bank switch or a mirroring change */
+        NesInternal_SyncPPU(Nes);
         NESCartridge_CPUWrite(Nes->Cartridge, Address, Byte);
+        Nes->CartridgeVersion++;
+
+        /* mappers can only change mirroring through a cpu write */
+        if (Nes->Cartridge->MirroringMode != Nes->PPU.MirroringMode)
+        {
+            NESPPU_UpdateNametableLayout(&Nes->PPU);
+        }
     }
 }
 
@@ -123,10 +466,21 @@ static u8 NesInternal_ReadByte(void *UserData, u16 Address)
     /* IO registers: PPU */
     else if (IN_RANGE(0x2000, Address, 0x3FFF))
     {
-        return NESPPU_ExternalRead(&Nes->PPU, Address & 0x07);
+        NesInternal_SyncPPU(Nes);
+        u8 Byte = NESPPU_ExternalRead(&Nes->PPU, Address & 0x07);
+        if (Nes->RasterRecorder)
+            NESRaster_Record(Nes->RasterRecorder, &Nes->PPU, Nes->Clk, Address, Byte, false);
+        if ((Address & 0x07) == PPU_STATUS && !Nes->DMA)
+            NesInternal_OnStatusPoll(Nes, Byte);
+        else Nes->StatusPoll.Valid = false;
+        return Byte;
     }
+
+    /* any other IO read could be what the cpu is waiting on */
+    if (IN_RANGE(0x4000, Address, 0x5FFF))
+        Nes->StatusPoll.Valid = false;
     /* get controller status */
-    else if (Address == 0x4017 || Address == 0x4016)
+    if (Address == 0x4017 || Address == 0x4016)
     {
         u8 ButtonStatus = Nes->ControllerStatusBuffer & 0x1;
         Nes->ControllerStatusBuffer >>= 1;
@@ -135,6 +489,7 @@ static u8 NesInternal_ReadByte(void *UserData, u16 Address)
     /* IO registers: DMA */
     else if (IN_RANGE(0x4000, Address, 0x401F))
     {
+        NESAPU_CatchUp(&Nes->APU, Nes->Clk);
         return NESAPU_ExternalRead(&Nes->APU, Address);
     }
     /* Expansion Rom */
@@ -169,6 +524,8 @@ static void Nes_ConnectCartridge(Emulator *Emu, NESCartridge NewCartridge)
 
     /* update the physical contents of the current cartridge inside the nes */
     *Nes->Cartridge = NewCartridge;
+    Nes->CartridgeVersion++;
+    NESPPU_UpdateNametableLayout(&Nes->PPU);
 }
 
 
@@ -278,7 +635,6 @@ const char *Nes_ParseINESFile(Platform_ThreadContext ThreadContext, const void *
     }
 
 
-    Emulator *Emu = ThreadContext.ViewPtr;
     NESCartridge Cartridge = NESCartridge_Init(
         FilePrgRom, PrgRomSize, 
         FileChrRom, ChrRomSize, 
@@ -294,7 +650,11 @@ const char *Nes_ParseINESFile(Platform_ThreadContext ThreadContext, const void *
     }
     else
     {
-        Nes_ConnectCartridge(Emu, Cartridge);
+        /* the old one could be in the middle of a read, the emulator thread swaps them */
+        Emulator *Emu = ThreadContext.ViewPtr;
+        NesInternal_WaitForCommand(Emu, EMU_COMMAND_CARTRIDGE);
+        Emu->NewCartridge = Cartridge;
+        NesInternal_PostCommand(Emu, EMU_COMMAND_CARTRIDGE);
         return NULL; /* no error */
     }
 
@@ -303,76 +663,377 @@ ErrorFileTooSmall:
 }
 
 
-Nes_DisplayableStatus Nes_PlatformQueryDisplayableStatus(Platform_ThreadContext ThreadContext)
+static void NesInternal_BumpDebugSectionVersion(NESDebugSection *Section)
+{
+    Section->Version++;
+    if (Section->Version == 0) /* 0 is reserved for 'never seen it' */
+        Section->Version = 1;
+}
+
+/* returns true if Section has to be recomputed because it was computed from something other than Key */
+static Bool8 NesInternal_DebugSectionIsStale(NESDebugSection *Section, u32 Key0, u32 Key1, u32 Key2, u32 Key3)
+{
+    u32 Key[4] = { Key0, Key1, Key2, Key3 };
+    if (Section->Version && Memcmp(Section->Key, Key, sizeof Key))
+        return false;
+
+    Memcpy(Section->Key, Key, sizeof Key);
+    NesInternal_BumpDebugSectionVersion(Section);
+    return true;
+}
+
+static u32 NesInternal_CopyDebugSection(const NESDebugSection *Section, u32 KnownVersion, void *Out, const void *Data, isize SizeBytes)
+{
+    if (Section->Version != KnownVersion)
+        Memcpy(Out, Data, SizeBytes);
+    return Section->Version;
+}
+
+u32 Nes_PlatformQueryDebugRegisters(Platform_ThreadContext ThreadContext, u32 KnownVersion, Nes_DebugRegisters *Out)
 {
     Emulator *Emu = ThreadContext.ViewPtr;
     NES *Nes = &Emu->Nes;
+    NESDebugView *View = &Emu->DebugView;
 
     u16 StackValue = (u16)Nes->Ram[0x100 + (u8)(Nes->CPU.SP + 1)];
     StackValue |= (u16)Nes->Ram[0x100 + (u8)(Nes->CPU.SP + 2)] << 8;
 
-    Nes_DisplayableStatus Status = {
-        .A = Nes->CPU.A,
-        .X = Nes->CPU.X,
-        .Y = Nes->CPU.Y,
-        .PC = Nes->CPU.PC,
-        .SP = Nes->CPU.SP + 0x100,
-        .StackValue = StackValue,
-
-        .N = MC6502_FlagGet(Nes->CPU.Flags, FLAG_N),
-        .Z = MC6502_FlagGet(Nes->CPU.Flags, FLAG_Z),
-        .V = MC6502_FlagGet(Nes->CPU.Flags, FLAG_V),
-        .C = MC6502_FlagGet(Nes->CPU.Flags, FLAG_C),
-        .I = MC6502_FlagGet(Nes->CPU.Flags, FLAG_I),
-        .U = MC6502_FlagGet(Nes->CPU.Flags, FLAG_UNUSED),
-        .B = MC6502_FlagGet(Nes->CPU.Flags, FLAG_B),
-        .D = MC6502_FlagGet(Nes->CPU.Flags, FLAG_D),
-    };
+    /* cheap enough to always compute, the version only changes when the registers do */
+    Nes_DebugRegisters Registers;
+    Memset(&Registers, 0, sizeof Registers); /* padding gets compared too */
+    Registers.A = Nes->CPU.A;
+    Registers.X = Nes->CPU.X;
+    Registers.Y = Nes->CPU.Y;
+    Registers.PC = Nes->CPU.PC;
+    Registers.SP = Nes->CPU.SP + 0x100;
+    Registers.StackValue = StackValue;
+    Registers.N = MC6502_FlagGet(Nes->CPU.Flags, FLAG_N);
+    Registers.Z = MC6502_FlagGet(Nes->CPU.Flags, FLAG_Z);
+    Registers.V = MC6502_FlagGet(Nes->CPU.Flags, FLAG_V);
+    Registers.C = MC6502_FlagGet(Nes->CPU.Flags, FLAG_C);
+    Registers.I = MC6502_FlagGet(Nes->CPU.Flags, FLAG_I);
+    Registers.U = MC6502_FlagGet(Nes->CPU.Flags, FLAG_UNUSED);
+    Registers.B = MC6502_FlagGet(Nes->CPU.Flags, FLAG_B);
+    Registers.D = MC6502_FlagGet(Nes->CPU.Flags, FLAG_D);
+
+    if (!View->RegistersSection.Version 
+    || !Memcmp(&View->Registers, &Registers, sizeof Registers))
+    {
+        View->Registers = Registers;
+        NesInternal_BumpDebugSectionVersion(&View->RegistersSection);
+    }
+    return NesInternal_CopyDebugSection(&View->RegistersSection, KnownVersion, Out, &View->Registers, sizeof *Out);
+}
 
-    NESPPU_GetRGBPalette(&Nes->PPU, Status.Palette, STATIC_ARRAY_SIZE(Status.Palette));
-    Status.PatternTablesAvailable = NESPPU_GetPatternTables(
-        &Nes->PPU, 
-        Status.LeftPatternTable, 
-        Status.RightPatternTable, 
-        Emu->CurrentPalette
-    );
-    if (Nes->Cartridge)
+u32 Nes_PlatformQueryDebugPalette(Platform_ThreadContext ThreadContext, u32 KnownVersion, Nes_DebugPalette *Out)
+{
+    Emulator *Emu = ThreadContext.ViewPtr;
+    NES *Nes = &Emu->Nes;
+    NESDebugView *View = &Emu->DebugView;
+
+    if (NesInternal_DebugSectionIsStale(&View->PaletteSection, 
+        Nes->PPU.PaletteVersion, 0, 0, 0))
+    {
+        NESPPU_GetRGBPalette(&Nes->PPU, View->Palette.Colors, STATIC_ARRAY_SIZE(View->Palette.Colors));
+    }
+    return NesInternal_CopyDebugSection(&View->PaletteSection, KnownVersion, Out, &View->Palette, sizeof *Out);
+}
+
+u32 Nes_PlatformQueryDebugPatternTables(Platform_ThreadContext ThreadContext, u32 KnownVersion, Nes_DebugPatternTables *Out)
+{
+    Emulator *Emu = ThreadContext.ViewPtr;
+    NES *Nes = &Emu->Nes;
+    NESDebugView *View = &Emu->DebugView;
+
+    /* CHR can change through a PPU write (CHR RAM) or a cpu write (CHR bank switch) */
+    if (NesInternal_DebugSectionIsStale(&View->PatternTablesSection, 
+        Nes->PPU.ChrVersion, Nes->CartridgeVersion, Nes->PPU.PaletteVersion, Emu->CurrentPalette))
     {
-        Nes_Disassemble(&Emu->DisassemblerState, Nes->Cartridge, Status.PC, 
-            Status.DisasmBeforePC, sizeof Status.DisasmBeforePC,
-            Status.DisasmAtPC, sizeof Status.DisasmAtPC,
-            Status.DisasmAfterPC, sizeof Status.DisasmAfterPC
+        View->PatternTables.Available = NESPPU_GetPatternTables(
+            &Nes->PPU, 
+            View->PatternTables.Left, 
+            View->PatternTables.Right, 
+            Emu->CurrentPalette
         );
     }
-    return Status;
+    return NesInternal_CopyDebugSection(&View->PatternTablesSection, KnownVersion, Out, &View->PatternTables, sizeof *Out);
 }
 
-static void NesInternal_OnPPUFrameCompletion(void *UserData)
+u32 Nes_PlatformQueryDebugDisassembly(Platform_ThreadContext ThreadContext, u32 KnownVersion, Nes_DebugDisassembly *Out)
+{
+    Emulator *Emu = ThreadContext.ViewPtr;
+    NES *Nes = &Emu->Nes;
+    NESDebugView *View = &Emu->DebugView;
+
+    if (!Nes->Cartridge)
+    {
+        /* nothing to disassemble, an empty listing still gets a version so that it can be shown */
+        if (NesInternal_DebugSectionIsStale(&View->DisassemblySection, 0, 0, 0, 0))
+            Memset(&View->Disassembly, 0, sizeof View->Disassembly);
+    }
+    else if (NesInternal_DebugSectionIsStale(&View->DisassemblySection, 
+        Nes->CPU.PC, Nes->CartridgeVersion, 0, 0))
+    {
+        Nes_Disassemble(&Emu->DisassemblerState, Nes->Cartridge, Nes->CPU.PC, 
+            View->Disassembly.BeforePC, sizeof View->Disassembly.BeforePC,
+            View->Disassembly.AtPC, sizeof View->Disassembly.AtPC,
+            View->Disassembly.AfterPC, sizeof View->Disassembly.AfterPC
+        );
+    }
+    return NesInternal_CopyDebugSection(&View->DisassemblySection, KnownVersion, Out, &View->Disassembly, sizeof *Out);
+}
+
+/* brings the PPU snapshot and the decoded tiles up to date, returns false if there is no snapshot yet */
+static Bool8 NesInternal_UpdatePPUViewerInputs(Emulator *Emu)
+{
+    NESDebugView *View = &Emu->DebugView;
+    Platform_AtomicExchange(&Emu->PPUSnapshotFramesLeft, PPU_SNAPSHOT_LINGER_FRAMES);
+    if (Emu->LatestPPUSnapshot & SCREEN_BUFFER_NEW)
+    {
+        u32 LatestIndex = Platform_AtomicExchange(&Emu->LatestPPUSnapshot, Emu->PPUSnapshotFrontIndex);
+        Emu->PPUSnapshotFrontIndex = LatestIndex & ~SCREEN_BUFFER_NEW;
+
+        /* most frames don't change a thing, so nothing gets redrawn then */
+        const NESPPU_Snapshot *Latest = &Emu->PPUSnapshot[Emu->PPUSnapshotFrontIndex];
+        if (!View->SnapshotSection.Version 
+        || !Memcmp(&View->Snapshot, Latest, sizeof View->Snapshot))
+        {
+            /* and CHR changes even less often */
+            Bool8 ChrChanged = !View->TileCacheSection.Version 
+                || !Memcmp(View->Snapshot.Chr, Latest->Chr, sizeof Latest->Chr);
+            View->Snapshot = *Latest;
+            NesInternal_BumpDebugSectionVersion(&View->SnapshotSection);
+            if (ChrChanged)
+            {
+                NESPPUViewer_DecodeTiles(&View->TileCache, View->Snapshot.Chr);
+                NesInternal_BumpDebugSectionVersion(&View->TileCacheSection);
+            }
+        }
+    }
+    return View->SnapshotSection.Version != 0;
+}
+
+u32 Nes_PlatformQueryDebugNametables(Platform_ThreadContext ThreadContext, u32 KnownVersion, Nes_DebugNametables *Out)
+{
+    Emulator *Emu = ThreadContext.ViewPtr;
+    NESDebugView *View = &Emu->DebugView;
+    if (NesInternal_UpdatePPUViewerInputs(Emu)
+    && NesInternal_DebugSectionIsStale(&View->NametablesSection, 
+        View->SnapshotSection.Version, View->TileCacheSection.Version, 0, 0))
+    {
+        NESPPUViewer_DrawNametables(&Emu->DebugViewPool, &View->Nametables, &View->Snapshot, &View->TileCache);
+    }
+    return NesInternal_CopyDebugSection(&View->NametablesSection, KnownVersion, Out, &View->Nametables, sizeof *Out);
+}
+
+u32 Nes_PlatformQueryDebugAttributes(Platform_ThreadContext ThreadContext, u32 KnownVersion, Nes_DebugAttributes *Out)
+{
+    Emulator *Emu = ThreadContext.ViewPtr;
+    NESDebugView *View = &Emu->DebugView;
+    if (NesInternal_UpdatePPUViewerInputs(Emu)
+    && NesInternal_DebugSectionIsStale(&View->AttributesSection, 
+        View->SnapshotSection.Version, 0, 0, 0))
+    {
+        NESPPUViewer_DrawAttributes(&View->Attributes, &View->Snapshot);
+    }
+    return NesInternal_CopyDebugSection(&View->AttributesSection, KnownVersion, Out, &View->Attributes, sizeof *Out);
+}
+
+u32 Nes_PlatformQueryDebugSprites(Platform_ThreadContext ThreadContext, u32 KnownVersion, Nes_DebugSprites *Out)
+{
+    Emulator *Emu = ThreadContext.ViewPtr;
+    NESDebugView *View = &Emu->DebugView;
+    if (NesInternal_UpdatePPUViewerInputs(Emu)
+    && NesInternal_DebugSectionIsStale(&View->SpritesSection, 
+        View->SnapshotSection.Version, View->TileCacheSection.Version, 0, 0))
+    {
+        NESPPUViewer_DrawSprites(&View->Sprites, &View->Snapshot, &View->TileCache);
+    }
+    return NesInternal_CopyDebugSection(&View->SpritesSection, KnownVersion, Out, &View->Sprites, sizeof *Out);
+}
+
+static Bool8 NesInternal_PPUSnapshotChrIsCurrent(const Emulator *Emu, u32 Index)
+{
+    return Emu->PPUSnapshotChrIsValid[Index]
+        && Emu->PPUSnapshotChrKey[Index][0] == Emu->Nes.PPU.ChrVersion
+        && Emu->PPUSnapshotChrKey[Index][1] == Emu->Nes.CartridgeVersion;
+}
+
+static void NesInternal_TakePPUSnapshot(Emulator *Emu)
+{
+    u32 Index = Emu->PPUSnapshotBackIndex;
+    NESPPU_Snapshot *Snapshot = &Emu->PPUSnapshot[Index];
+    NESPPU_TakeSnapshot(&Emu->Nes.PPU, Snapshot);
+
+    /* reading CHR through the mapper is most of the work and it hardly ever changes, so it's kept when still current 
+     * or copied from the snapshot taken last (which the host might be reading, but never writes) */
+    if (!NesInternal_PPUSnapshotChrIsCurrent(Emu, Index))
+    {
+        if (NesInternal_PPUSnapshotChrIsCurrent(Emu, Emu->PPUSnapshotLastIndex))
+            Memcpy(Snapshot->Chr, Emu->PPUSnapshot[Emu->PPUSnapshotLastIndex].Chr, sizeof Snapshot->Chr);
+        else NESPPU_TakeChrSnapshot(&Emu->Nes.PPU, Snapshot);
+        Emu->PPUSnapshotChrKey[Index][0] = Emu->Nes.PPU.ChrVersion;
+        Emu->PPUSnapshotChrKey[Index][1] = Emu->Nes.CartridgeVersion;
+        Emu->PPUSnapshotChrIsValid[Index] = true;
+    }
+
+    Emu->PPUSnapshotLastIndex = Index;
+    u32 Previous = Platform_AtomicExchange(&Emu->LatestPPUSnapshot, Index | SCREEN_BUFFER_NEW);
+    Emu->PPUSnapshotBackIndex = Previous & ~SCREEN_BUFFER_NEW;
+}
+
+static void NesInternal_OnPPUFrameCompletion(void *UserData, Bool8 Skipped)
 {
     Emulator *Emu = UserData;
+    /* only the viewers put it back up, so this is the only thread counting down */
+    if (Emu->PPUSnapshotFramesLeft)
+    {
+        Platform_AtomicAdd(&Emu->PPUSnapshotFramesLeft, (u32)-1);
+        NesInternal_TakePPUSnapshot(Emu);
+    }
 
-    /* swap the front and back buffers */
-    u32 (*Tmp)[NES_SCREEN_BUFFER_SIZE] = Emu->BackBuffer;
-    Emu->BackBuffer = Emu->FrontBuffer;
-    Emu->FrontBuffer = Tmp;
+    /* the back buffer was never drawn to, or was only partly drawn to in the format it's in now, 
+     * keep presenting the last frame that was */
+    Bool8 FormatChanged = Emu->ScreenBufferFormatChanged;
+    Emu->ScreenBufferFormatChanged = false;
+    if (Skipped || FormatChanged)
+        return;
 
-    Emu->Nes.PPU.ScreenOutput = Emu->BackBuffer[0];
+    u64 Hash;
+    Bool8 HashIsValid = NESPPU_GetFrameHash(&Emu->Nes.PPU, &Hash);
+    if (Emu->DrawingToTarget)
+    {
+        /* the host owns it, nothing to swap */
+        Emu->FrameSequence++;
+        Emu->TargetScreenHash = Hash;
+        Emu->TargetScreenHashIsValid = HashIsValid;
+        return;
+    }
+
+    /* publish the back buffer as the latest frame, and take whichever buffer was there before, 
+     * the presenter is never using that one */
+    Emu->FrameSequence++;
+    Emu->ScreenBufferSequence[Emu->BackBufferIndex] = Emu->FrameSequence;
+    Emu->ScreenBufferHash[Emu->BackBufferIndex] = Hash;
+    Emu->ScreenBufferHashIsValid[Emu->BackBufferIndex] = HashIsValid;
+    Emu->ScreenBufferFormat[Emu->BackBufferIndex] = Emu->Nes.PPU.PixelFormat;
+    u32 Previous = Platform_AtomicExchange(&Emu->LatestFrame, Emu->BackBufferIndex | SCREEN_BUFFER_NEW);
+    Emu->BackBufferIndex = Previous & ~SCREEN_BUFFER_NEW;
+
+    Emu->Nes.PPU.ScreenOutput = Emu->ScreenBuffer[Emu->BackBufferIndex];
+}
+
+static void NesInternal_OnPPUScanlinesCompleted(void *UserData, uint FirstScanline, uint ScanlineCount)
+{
+    Emulator *Emu = UserData;
+    const NESPPU *PPU = &Emu->Nes.PPU;
+    Platform_FrameBuffer Band = {
+        .Data = (const u8 *)PPU->ScreenOutput + FirstScanline * PPU->ScreenPitch,
+        .Width = NES_SCREEN_WIDTH,
+        .Height = ScanlineCount,
+        .Sequence = Emu->FrameSequence + 1, /* the frame these scanlines will be part of */
+        .Pitch = PPU->ScreenPitch,
+        .PixelFormat = PPU->PixelFormat,
+    };
+    Platform_OnScanlinesCompleted(Band, FirstScanline);
 }
 
 static void NesInternal_OnPPUNmi(void *UserData)
 {
     Emulator *Emu = UserData;
+    Emu->Nes.CPUSkipCycles = 0;
+    Emu->Nes.StatusPoll.Valid = false;
     MC6502_Interrupt(&Emu->Nes.CPU, VEC_NMI);
 }
 
+/* whether the frame about to be returned by Nes_PlatformQueryFrameBuffer looks exactly like the last one it returned, 
+ * Hash is of the frame before filtering */
+static Bool8 NesInternal_IsSameAsLastFrame(Emulator *Emu, u32 Sequence, u64 Hash, Bool8 HashIsValid, Bool8 NTSCFiltered)
+{
+    /* FilteredScreenIsValid is false after any change to how frames are filtered */
+    Bool8 SameFrame = Emu->FilteredScreenIsValid 
+        && Emu->FilteredScreenSequence == Sequence;
+    /* identical pixels still come out differently from the NTSC filter, the signal's phase changes every frame */
+    Bool8 SamePixels = Emu->FilteredScreenIsValid 
+        && !NTSCFiltered
+        && HashIsValid && Emu->FilteredScreenHashIsValid 
+        && Emu->FilteredScreenHash == Hash;
+
+    Emu->FilteredScreenIsValid = true;
+    Emu->FilteredScreenSequence = Sequence;
+    Emu->FilteredScreenHash = Hash;
+    Emu->FilteredScreenHashIsValid = HashIsValid;
+    return SameFrame || SamePixels;
+}
+
 Platform_FrameBuffer Nes_PlatformQueryFrameBuffer(Platform_ThreadContext ThreadContext)
 {
     Emulator *Emu = ThreadContext.ViewPtr;
+    if (Emu->TargetScreen)
+    {
+        Platform_FrameBuffer Frame = {
+            .Data = Emu->TargetScreen,
+            .Width = NES_SCREEN_WIDTH,
+            .Height = NES_SCREEN_HEIGHT,
+            .Sequence = Emu->FrameSequence,
+            .Pitch = Emu->TargetScreenPitch,
+            .PixelFormat = Emu->TargetScreenFormat,
+        };
+        Frame.Unchanged = NesInternal_IsSameAsLastFrame(Emu, 
+            Frame.Sequence, Emu->TargetScreenHash, Emu->TargetScreenHashIsValid, false
+        );
+        return Frame;
+    }
+
+    /* trade the front buffer for the latest frame if there is a new one, 
+     * otherwise keep showing the current front buffer */
+    if (Emu->LatestFrame & SCREEN_BUFFER_NEW)
+    {
+        u32 Latest = Platform_AtomicExchange(&Emu->LatestFrame, Emu->FrontBufferIndex);
+        Emu->FrontBufferIndex = Latest & ~SCREEN_BUFFER_NEW;
+    }
+
     Platform_FrameBuffer Frame = {
-        .Data = Emu->FrontBuffer,
+        .Data = Emu->ScreenBuffer[Emu->FrontBufferIndex],
         .Width = NES_SCREEN_WIDTH,
         .Height = NES_SCREEN_HEIGHT,
+        .Sequence = Emu->ScreenBufferSequence[Emu->FrontBufferIndex],
+        .Pitch = NES_SCREEN_WIDTH * sizeof(u32),
+        .PixelFormat = NES_PIXELFORMAT_XRGB8888,
     };
+    /* goes by the format the frame was drawn in, which lags behind Nes_SetNTSCFilter by a frame or two */
+    Bool8 NTSCFiltered = Emu->ScreenBufferFormat[Emu->FrontBufferIndex] == NES_PIXELFORMAT_PALETTE_INDEX;
+
+    /* filtering is done here instead of on the emulator thread, and only once per new frame */
+    Frame.Unchanged = NesInternal_IsSameAsLastFrame(Emu, 
+        Frame.Sequence, 
+        Emu->ScreenBufferHash[Emu->FrontBufferIndex], 
+        Emu->ScreenBufferHashIsValid[Emu->FrontBufferIndex],
+        NTSCFiltered
+    );
+    Bool8 ShouldFilter = !Frame.Unchanged;
+    if (NTSCFiltered)
+    {
+        if (ShouldFilter)
+        {
+            NESNTSC_RunPooled(&Emu->ScalerPool, Emu->FilteredScreen, Frame.Data, NES_SCREEN_WIDTH * sizeof(u16), Frame.Sequence);
+        }
+        Frame.Data = Emu->FilteredScreen;
+        Frame.Width = NES_NTSC_OUTPUT_WIDTH;
+        Frame.Pitch = NES_NTSC_OUTPUT_WIDTH * sizeof(u32);
+    }
+    else if (Emu->Scaler != NES_SCALER_NONE)
+    {
+        if (ShouldFilter)
+        {
+            NESScaler_RunPooled(&Emu->ScalerPool, Emu->Scaler, Emu->FilteredScreen, Frame.Data, Frame.Width, Frame.Height);
+        }
+        uint Factor = NESScaler_GetFactor(Emu->Scaler);
+        Frame.Data = Emu->FilteredScreen;
+        Frame.Width *= Factor;
+        Frame.Height *= Factor;
+        Frame.Pitch *= Factor;
+    }
     return Frame;
 }
 
@@ -389,16 +1050,28 @@ Platform_AudioConfig Nes_OnEntry(Platform_ThreadContext ThreadContext)
     DEBUG_ASSERT(ThreadContext.ViewPtr);
     DEBUG_ASSERT(ThreadContext.SizeBytes == sizeof(Emulator));
 
-    u32 AudioSampleRate = 48000;
     Emulator *Emu = ThreadContext.ViewPtr;
 
-    Emu->MasterClkPerAudioSample = NES_MASTER_CLK / AudioSampleRate;
-    Emu->BackBuffer = &Emu->ScreenBuffer[0];
-    Emu->FrontBuffer = &Emu->ScreenBuffer[1];
+    Emu->AudioSampleRate = NES_DEFAULT_AUDIO_SAMPLE_RATE;
+    Emu->AudioLatencyBudget = NES_DEFAULT_AUDIO_LATENCY_MS;
+    Emu->AudioRingTarget = Emu->AudioSampleRate / 1000 * AUDIO_INITIAL_TARGET_MS;
+    Emu->BackBufferIndex = 0;
+    Emu->LatestFrame = 1;
+    Emu->FrontBufferIndex = 2;
+    Emu->PPUSnapshotBackIndex = 0;
+    Emu->LatestPPUSnapshot = 1;
+    Emu->PPUSnapshotFrontIndex = 2;
+    Emu->PPUSnapshotFramesLeft = 0;
+    Emu->PPUSnapshotLastIndex = 0;
+    for (uint i = 0; i < STATIC_ARRAY_SIZE(Emu->PPUSnapshotChrIsValid); i++)
+        Emu->PPUSnapshotChrIsValid[i] = false;
     Emu->EmulationDone = false;
     Emu->EmulationHalted = false;
     Emu->EmulationMode = EMUMODE_SINGLE_FRAME;
     Emu->CurrentPalette = 0;
+    Emu->ScalerPool = NESScaler_InitPool();
+    Emu->DebugViewPool = NESScaler_InitPool();
+    NESRaster_Init(&Emu->RasterRecorder);
 
     Emu->Nes.CPU = MC6502_Init(
         0, 
@@ -410,12 +1083,15 @@ Platform_AudioConfig Nes_OnEntry(Platform_ThreadContext ThreadContext)
         Emu,
         NesInternal_OnPPUFrameCompletion, 
         NesInternal_OnPPUNmi, 
-        *Emu->BackBuffer, 
+        Emu->ScreenBuffer[Emu->BackBufferIndex], 
         &Emu->Nes.Cartridge
     );
+    NESPPU_UpdateNametableLayout(&Emu->Nes.PPU);
     Emu->Nes.APU = NESAPU_Init(
-        Platform_GetTimeMillisec()
+        Platform_GetTimeMillisec(),
+        Emu->AudioSampleRate
     );
+    NesInternal_ScheduleDMC(&Emu->Nes);
     Emu->DisassemblerState = (NESDisassemblerState) {
         .Count = 16,
         .BytesPerLine = 3,
@@ -424,11 +1100,12 @@ Platform_AudioConfig Nes_OnEntry(Platform_ThreadContext ThreadContext)
     u32 AudioChannelCount = 1;
     Platform_AudioConfig AudioConfig = {
         .EnableAudio = true,
-        .SampleRate = AudioSampleRate,
+        .SampleRate = Emu->AudioSampleRate,
         .ChannelCount = AudioChannelCount, 
-        .BufferSizeBytes = 1024 * AudioChannelCount * sizeof(int16_t),
-        .BufferQueueSize = 8,
+        .BufferSizeBytes = AUDIO_DEVICE_BUFFER_FRAMES * AudioChannelCount * sizeof(int16_t),
+        .BufferQueueSize = AUDIO_DEVICE_BUFFER_COUNT,
     };
+    Emu->AudioDeviceFrames = AUDIO_DEVICE_BUFFER_FRAMES * AUDIO_DEVICE_BUFFER_COUNT;
 
     
     return AudioConfig;
@@ -440,19 +1117,56 @@ void Nes_OnAudioFailed(Platform_ThreadContext ThreadContext)
 
 
 
+/* the DMC's memory reader takes the bus for a byte (see NesInternal_ScheduleDMC) */
+static void NesInternal_DMCFetch(NES *Nes)
+{
+    NESAPU_CatchUp(&Nes->APU, Nes->Clk);
+    if (NESAPU_NextDMCFetch(&Nes->APU) <= Nes->Clk)
+    {
+        u8 Byte = NesInternal_ReadByte(Nes, NESAPU_DMCFetchAddr(&Nes->APU));
+        NESAPU_DMCLoadSample(&Nes->APU, Byte);
+
+        /* the cpu sits out while the DMA has the bus, which also throws off the timing of any PPUSTATUS polling, 
+         * an OAM DMA gets held up for less (an even number of cycles, so it stays in step with its reads and writes) */
+        Nes->DMCStallCycles += Nes->DMA? DMC_FETCH_STALL_CYCLES_DURING_OAM_DMA : DMC_FETCH_STALL_CYCLES;
+        Nes->StatusPoll.Valid = false;
+    }
+    NesInternal_ScheduleDMC(Nes);
+}
+
 static Bool8 Nes_StepClock(NES *Nes)
 {
     Nes->Clk++;
-    NESAPU_StepClock(&Nes->APU);
-    Bool8 FrameCompleted = NESPPU_StepClock(&Nes->PPU);
+    if (Nes->Clk >= Nes->EventClk)
+    {
+        if (Nes->Clk >= Nes->PPUSyncClk)
+            NesInternal_SyncPPU(Nes);
+        /* always lands on a cpu cycle */
+        if (Nes->Clk >= Nes->DMCFetchClk)
+            NesInternal_DMCFetch(Nes);
+    }
     if (Nes->Clk % 3 == 0)
     {
-        if (!Nes->DMA)
+        if (Nes->DMCStallCycles)
         {
+            Nes->DMCStallCycles--;
+        }
+        else if (Nes->CPUSkipCycles && !Nes->DMA)
+        {
+            /* the cpu is polling PPUSTATUS (see NesInternal_OnStatusPoll), its state would be the same afterward */
+            Nes->CPUSkipCycles--;
+        }
+        else if (!Nes->DMA)
+        {
+            /* the IRQ line is level triggered, it's taken between instructions for as long as it's held 
+             * (MC6502_Interrupt ignores it while the I flag is set) */
+            if (Nes->APUIRQ && 0 == Nes->CPU.CyclesLeft)
+                MC6502_Interrupt(&Nes->CPU, VEC_IRQ);
             MC6502_StepClock(&Nes->CPU);
         }
         else if (Nes->DMAOutOfSync)
         {
+            NesInternal_SyncPPU(Nes);
             if (Nes->Clk % 2 == 1)
             {
                 Nes->DMAOutOfSync = false;
@@ -471,11 +1185,12 @@ static Bool8 Nes_StepClock(NES *Nes)
             else
             {
                 u16 DMAAddrPrev = Nes->DMAAddr++;
-                NESPPU_ExternalWrite(&Nes->PPU, PPU_OAM_DATA, Nes->DMAData);
+                NesInternal_WritePPU(Nes, PPU_OAM_DATA, Nes->DMAData);
 
                 /* transfer is complete (1 page has wrapped) */
                 if ((DMAAddrPrev & 0xFF00) != (Nes->DMAAddr & 0xFF00))
                 {
+                    NesInternal_SyncPPU(Nes); /* the PPU thread could still be on the writes above */
                     Nes->DMA = false;
                     Nes->DMAOutOfSync = true;
                     Nes->PPU.OAMAddr = Nes->DMASaveAddr;
@@ -483,57 +1198,301 @@ static Bool8 Nes_StepClock(NES *Nes)
             }
         }
     }
+
+    Bool8 FrameCompleted = Nes->PPUFrameCompleted;
+    Nes->PPUFrameCompleted = false;
     return FrameCompleted;
 }
 
-int16_t Nes_OnAudioSampleRequest(Platform_ThreadContext ThreadContext, double t)
+void Nes_RenderAudio(Platform_ThreadContext ThreadContext, int16_t *Out, u32 FrameCount, u32 ChannelCount)
 {
     Emulator *Emu = ThreadContext.ViewPtr;
-    NES *Nes = &Emu->Nes;
+    DEBUG_ASSERT(ChannelCount > 0);
 
-    if (!Emu->EmulationHalted)
+    Nes_AudioStats *Stats = &Emu->AudioStats;
+
+    /* how regularly the platform asks, the ring has to cover for it being late */
+    double Now = Platform_GetTimeMillisec();
+    if (Emu->LastAudioRequestFrames)
     {
-        for (u32 i = 0; i < Emu->MasterClkPerAudioSample; i++)
+        double Interval = Now - Emu->LastAudioRequestTime;
+        double Expected = Emu->LastAudioRequestFrames * 1000.0 / Emu->AudioSampleRate;
+        double Deviation = Interval > Expected? Interval - Expected : Expected - Interval;
+        Stats->CallbackIntervalMs += (Interval - Stats->CallbackIntervalMs) / 16;
+        Stats->CallbackJitterMs += (Deviation - Stats->CallbackJitterMs) / 16;
+    }
+    Emu->LastAudioRequestTime = Now;
+    Emu->LastAudioRequestFrames = FrameCount;
+    Platform_AtomicExchange(&Emu->AudioRequestFrames, FrameCount);
+    Platform_AtomicExchange(&Emu->AudioCallbackJitterUs, (u32)(Stats->CallbackJitterMs * 1000));
+
+    /* ran dry (halted, or the emulator thread fell behind), hold the last sample instead of clicking */
+    u32 Read = NESAudioRing_Read(&Emu->AudioRing, Out, FrameCount);
+    if (Read)
+        Emu->LastAudioSample = Out[Read - 1];
+    if (Read < FrameCount && !Emu->EmulationHalted && Emu->AudioStarted)
+        Stats->Underruns++;
+    for (u32 i = Read; i < FrameCount; i++)
+        Out[i] = Emu->LastAudioSample;
+
+    /* the APU is mono, spread it to every channel, backward so nothing gets overwritten before it's read */
+    if (ChannelCount > 1)
+    {
+        for (u32 i = FrameCount; i-- > 0;)
         {
-            Nes_StepClock(Nes);
+            for (u32 c = 0; c < ChannelCount; c++)
+                Out[i*ChannelCount + c] = Out[i];
         }
     }
-    else if (!Emu->EmulationDone)
+}
+
+void Nes_OnAudioDeviceStarved(Platform_ThreadContext ThreadContext)
+{
+    Emulator *Emu = ThreadContext.ViewPtr;
+    if (!Emu->EmulationHalted && Emu->AudioStarted)
+        Emu->AudioStats.DeviceUnderruns++;
+}
+
+/* moves AudioRingTarget between the least the ring can get away with and the latency budget: 
+ * up quickly after every underrun, back down a little after every second without one */
+static void NesInternal_AdaptAudioLatency(Emulator *Emu, u32 SamplesProduced)
+{
+    Nes_AudioStats *Stats = &Emu->AudioStats;
+    u32 SamplesPerMs = Emu->AudioSampleRate / 1000;
+
+    /* a whole request, plus how late those tend to be, plus the chunk the emulator thread produces at a time */
+    u32 Floor = Emu->AudioRequestFrames 
+        + (u32)((u64)2*Emu->AudioCallbackJitterUs*SamplesPerMs / 1000) 
+        + 2*SamplesPerMs;
+    if (Floor > AUDIO_RING_SIZE / 2)
+        Floor = AUDIO_RING_SIZE / 2;
+    u32 Budget = Emu->AudioLatencyBudget * SamplesPerMs;
+    u32 Ceiling = Budget > Emu->AudioDeviceFrames? Budget - Emu->AudioDeviceFrames : 0;
+    if (Ceiling > AUDIO_RING_SIZE / 2)
+        Ceiling = AUDIO_RING_SIZE / 2;
+    if (Ceiling < Floor)
+        Ceiling = Floor;
+
+    u32 Underruns = Stats->Underruns + Stats->DeviceUnderruns;
+    if (Underruns != Emu->AudioUnderrunsSeen)
     {
-        Emu->EmulationDone = true;
+        Emu->AudioUnderrunsSeen = Underruns;
+        Emu->AudioSamplesSinceUnderrun = 0;
+        Emu->AudioRingTarget += Emu->AudioRingTarget / 4 + SamplesPerMs;
+    }
+    else
+    {
+        Emu->AudioSamplesSinceUnderrun += SamplesProduced;
+        if (Emu->AudioSamplesSinceUnderrun >= Emu->AudioSampleRate)
+        {
+            Emu->AudioSamplesSinceUnderrun = 0;
+            Emu->AudioRingTarget -= Emu->AudioRingTarget / 16;
+        }
     }
 
-    double AudioSample = Nes->APU.AudioSample;
-    if (AudioSample >= INT16_MAX)
-        return INT16_MAX;
-    if (AudioSample <= INT16_MIN)
-        return INT16_MIN;
-    return (int16_t)AudioSample;
+    if (Emu->AudioRingTarget < Floor)
+        Emu->AudioRingTarget = Floor;
+    if (Emu->AudioRingTarget > Ceiling)
+        Emu->AudioRingTarget = Ceiling;
+    Stats->TargetSamples = Emu->AudioRingTarget;
 }
 
+/* moves everything the APU has into the audio ring */
+static void NesInternal_ProduceAudio(Emulator *Emu)
+{
+    NESAPU *APU = &Emu->Nes.APU;
+    NESAPU_CatchUp(APU, Emu->Nes.Clk);
+
+    Bool8 Stems = Emu->AudioStemsRequested;
+    if (Stems && !APU->StemsEnabled)
+    {
+        /* whatever was left from the last time they were on would be read first */
+        for (uint i = 0; i < NES_AUDIO_STEM_COUNT; i++)
+            NESAudioRing_Discard(&Emu->AudioStems[i]);
+    }
+    NESAPU_EnableStems(APU, Stems);
+
+    i16 Samples[1024];
+    i16 StemSamples[NES_AUDIO_STEM_COUNT][STATIC_ARRAY_SIZE(Samples)];
+    i16 *StemPtrs[NES_AUDIO_STEM_COUNT];
+    for (uint i = 0; i < NES_AUDIO_STEM_COUNT; i++)
+        StemPtrs[i] = StemSamples[i];
+
+    uint Available;
+    u32 Produced = 0;
+    while ((Available = NESAPU_SamplesAvailable(APU)) > 0)
+    {
+        uint Count = Available < STATIC_ARRAY_SIZE(Samples)? Available : STATIC_ARRAY_SIZE(Samples);
+        NESAPU_ReadSamples(APU, Samples, Count);
+        Produced += Count;
+        if (Stems)
+        {
+            /* nobody might be reading these, the newest samples push the oldest ones out */
+            NESAPU_ReadStems(APU, StemPtrs, Count);
+            for (uint i = 0; i < NES_AUDIO_STEM_COUNT; i++)
+                NESAudioRing_Overwrite(&Emu->AudioStems[i], StemSamples[i], Count);
+        }
+
+        /* way more waiting than there should be (the emulator thread just caught up after a stall), 
+         * throw these away instead of lagging behind by that much until the rate control drains it */
+        if (NESAudioRing_Count(&Emu->AudioRing) > 2*Emu->AudioRingTarget + Count
+        || NESAudioRing_Write(&Emu->AudioRing, Samples, Count) < Count)
+        {
+            Emu->AudioStats.Overruns++;
+        }
+        Emu->AudioStarted = true;
+    }
+    NesInternal_AdaptAudioLatency(Emu, Produced);
+
+    /* dynamic rate control: the audio device's clock never quite agrees with the one the emulator runs on, 
+     * so resample a hair faster or slower depending on how full the ring is, 
+     * which pulls it back toward AudioRingTarget instead of letting it run dry or overflow. 
+     * At most half a percent, way too little to hear the pitch change */
+    double Deviation = ((double)NESAudioRing_Count(&Emu->AudioRing) - Emu->AudioRingTarget) / Emu->AudioRingTarget;
+    if (Deviation > 1)
+        Deviation = 1;
+    if (Deviation < -1)
+        Deviation = -1;
+    NESAPU_SetSampleRate(APU, (u32)(Emu->AudioSampleRate * (1.0 - AUDIO_MAX_RATE_ADJUSTMENT*Deviation) + .5));
+}
+
+
+
+static void NesInternal_Reset(Emulator *Emu)
+{
+    Emu->Nes.Clk = 0;
+    Emu->Nes.PPUClk = 0;
+    Emu->Nes.PPUSyncClk = 0;
+    Emu->Nes.PPUFrameCompleted = false;
+    Emu->Nes.CPUSkipCycles = 0;
+    Emu->Nes.DMCStallCycles = 0;
+    Emu->Nes.StatusPoll.Valid = false;
+    MC6502_Reset(&Emu->Nes.CPU);
+    NESPPU_Reset(&Emu->Nes.PPU);
+    NESAPU_Reset(&Emu->Nes.APU);
+    NesInternal_ScheduleDMC(&Emu->Nes);
+    if (Emu->Nes.Cartridge)
+        NESCartridge_Reset(Emu->Nes.Cartridge);
+    Emu->Nes.CartridgeVersion++;
+}
 
+/* points the PPU at the back buffer in whichever format the NTSC filter needs, unless it's drawing into a target */
+static void NesInternal_UpdateScreenOutput(Emulator *Emu)
+{
+    if (Emu->DrawingToTarget)
+        return;
+
+    /* the filter needs color indices instead of rgb */
+    Bool8 NTSC = Emu->NTSCFilterEnabled;
+    Emu->ScreenBufferFormatChanged = true;
+    NESPPU_SetScreenOutput(&Emu->Nes.PPU, 
+        Emu->ScreenBuffer[Emu->BackBufferIndex], 
+        NES_SCREEN_WIDTH * (NTSC? sizeof(u16) : sizeof(u32)), 
+        NTSC? NES_PIXELFORMAT_PALETTE_INDEX : NES_PIXELFORMAT_XRGB8888
+    );
+}
 
+/* on the emulator thread, before and between chunks: 
+ * does whatever the other threads asked for since the last time, once the PPU is caught up */
+static void NesInternal_RunCommands(Emulator *Emu)
+{
+    NES *Nes = &Emu->Nes;
+    NESPPUQueue *PPUQueue = Emu->PPUThreadRequested? &Emu->PPUQueue : NULL;
+    NESRasterRecorder *RasterRecorder = Emu->RasterRecorderRequested? &Emu->RasterRecorder : NULL;
+    Bool8 NTSCFilterChanged = !Emu->DrawingToTarget 
+        && Emu->NTSCFilterEnabled != (Nes->PPU.PixelFormat == NES_PIXELFORMAT_PALETTE_INDEX);
+    Bool8 FrameSkipChanged = Emu->FrameSkipRequested != Nes->PPU.FrameSkip;
+    Bool8 ScanlineBandChanged = Emu->ScanlinesPerBandRequested != Nes->PPU.ScanlinesPerBand;
+    if (!Emu->PendingCommands 
+    && PPUQueue == Nes->PPUQueue 
+    && RasterRecorder == Nes->RasterRecorder
+    && !NTSCFilterChanged && !FrameSkipChanged && !ScanlineBandChanged)
+    {
+        return;
+    }
 
+    /* full barrier, the arguments are only read after their bits are */
+    u32 Commands = Platform_AtomicAdd(&Emu->PendingCommands, 0);
+
+    /* the PPU thread could be in the middle of using anything below, 
+     * and the PPU only changes hands once it's caught up to the cpu */
+    NesInternal_SyncPPU(Nes);
+    Nes->PPUQueue = PPUQueue;
+
+    if (RasterRecorder != Nes->RasterRecorder)
+    {
+        if (RasterRecorder)
+            NESRaster_Restart(RasterRecorder);
+        Nes->RasterRecorder = RasterRecorder;
+    }
+
+    /* a new cartridge is usually followed by a reset, so it goes in first */
+    if (Commands & EMU_COMMAND_CARTRIDGE)
+        Nes_ConnectCartridge(Emu, Emu->NewCartridge);
+    if (Commands & EMU_COMMAND_RESET)
+        NesInternal_Reset(Emu);
+
+    if (Commands & EMU_COMMAND_SCREEN_TARGET)
+    {
+        Emu->DrawingToTarget = Emu->TargetScreen != NULL;
+        Emu->TargetScreenHashIsValid = false;
+        if (Emu->DrawingToTarget)
+            NESPPU_SetScreenOutput(&Nes->PPU, Emu->TargetScreen, Emu->TargetScreenPitch, Emu->TargetScreenFormat);
+        else NesInternal_UpdateScreenOutput(Emu);
+    }
+    else if (NTSCFilterChanged)
+    {
+        NesInternal_UpdateScreenOutput(Emu);
+    }
+
+    if (FrameSkipChanged)
+        NESPPU_SetFrameSkip(&Nes->PPU, Emu->FrameSkipRequested);
+    if (ScanlineBandChanged)
+        NESPPU_SetScanlineCallback(&Nes->PPU, NesInternal_OnPPUScanlinesCompleted, Emu->ScanlinesPerBandRequested);
+
+    /* done with the arguments, hand them back */
+    Platform_AtomicAdd(&Emu->PendingCommands, 0 - Commands);
+}
 
 void Nes_OnLoop(Platform_ThreadContext ThreadContext, double ElapsedTime)
 {
-    return;
     Emulator *Emu = ThreadContext.ViewPtr;
     NES *Nes = &Emu->Nes;
+
+    NesInternal_RunCommands(Emu);
     if (!Emu->EmulationHalted)
     {
-        if (Emu->ResidueTime < ElapsedTime)
+        /* where real time is at, computed from scratch every time so there's nothing to drift */
+        u64 TargetClk = (u64)((ElapsedTime - Emu->TimeOrigin) * (NES_MASTER_CLK / 1000.0));
+
+        /* the platform stalled (or the emulator can't keep up), pick up from here instead of rushing to catch up */
+        if (TargetClk > Emu->EmulatedClk + EMU_MAX_CATCHUP_CLK)
+            Emu->EmulatedClk = TargetClk - EMU_MAX_CATCHUP_CLK;
+
+        /* a bit at a time, so the audio ring never waits too long for samples */
+        while (Emu->EmulatedClk < TargetClk)
         {
-            Emu->ResidueTime += 1000.0 / 60.0;
-            Bool8 FrameCompleted = false;
-            do {
-                FrameCompleted = Nes_StepClock(Nes);
-            } while (!FrameCompleted);
+            u64 Clocks = TargetClk - Emu->EmulatedClk;
+            if (Clocks > EMU_AUDIO_CHUNK_CLK)
+                Clocks = EMU_AUDIO_CHUNK_CLK;
+            for (u64 i = 0; i < Clocks; i++)
+            {
+                Nes_StepClock(Nes);
+            }
+            Emu->EmulatedClk += Clocks;
+            NesInternal_ProduceAudio(Emu);
+
+            /* let the PPU thread run up to here without waiting on it, 
+             * it'll get there on the next sync if the queue is full */
+            if (Nes->PPUQueue)
+                NESPPUQueue_Push(Nes->PPUQueue, Nes->Clk, PPU_QUEUE_SYNC, 0);
+            NesInternal_RunCommands(Emu);
         }
     }
     else
     {
-        Emu->ResidueTime = ElapsedTime;
+        Emu->TimeOrigin = ElapsedTime;
+        Emu->EmulatedClk = 0;
         if (Emu->EmulationDone)
             return;
 
@@ -557,9 +1516,35 @@ void Nes_OnLoop(Platform_ThreadContext ThreadContext, double ElapsedTime)
             } while (!FrameDone);
         } break;
         }
+        NesInternal_ProduceAudio(Emu);
     }
 }
 
+Bool8 Nes_OnPPULoop(Platform_ThreadContext ThreadContext)
+{
+    Emulator *Emu = ThreadContext.ViewPtr;
+    NES *Nes = &Emu->Nes;
+    Bool8 DidAnything = false;
+    const NESPPUQueueEntry *Entry;
+    while ((Entry = NESPPUQueue_Peek(&Emu->PPUQueue)) != NULL)
+    {
+        NesInternal_StepPPU(Nes, Entry->Clk);
+        if (Entry->Address != PPU_QUEUE_SYNC)
+            NesInternal_ApplyPPUWrite(Nes, Entry->Clk, Entry->Address, Entry->Byte);
+        NESPPUQueue_Pop(&Emu->PPUQueue);
+        DidAnything = true;
+    }
+    return DidAnything;
+}
+
+Bool8 Nes_OnScalerLoop(Platform_ThreadContext ThreadContext)
+{
+    Emulator *Emu = ThreadContext.ViewPtr;
+    Bool8 DidAnything = NESScaler_WorkOnPool(&Emu->ScalerPool);
+    DidAnything |= NESScaler_WorkOnPool(&Emu->DebugViewPool);
+    return DidAnything;
+}
+
 void Nes_AtExit(Platform_ThreadContext ThreadContext)
 {
     Emulator *Emu = ThreadContext.ViewPtr;
@@ -567,6 +1552,11 @@ void Nes_AtExit(Platform_ThreadContext ThreadContext)
     {
         NESCartridge_Destroy(Emu->Nes.Cartridge);
     }
+    /* loaded but never got to the emulator thread */
+    if (Emu->PendingCommands & EMU_COMMAND_CARTRIDGE)
+    {
+        NESCartridge_Destroy(&Emu->NewCartridge);
+    }
 }
 
 
@@ -593,15 +1583,119 @@ void Nes_OnEmulatorSingleFrame(Platform_ThreadContext ThreadContext)
     Emu->EmulationDone = false;
 }
 
+void Nes_SetAudioSampleRate(Platform_ThreadContext ThreadContext, u32 SampleRate)
+{
+    Emulator *Emu = ThreadContext.ViewPtr;
+    DEBUG_ASSERT(SampleRate > 0);
+    Emu->AudioSampleRate = SampleRate;
+    NESAPU_SetSampleRate(&Emu->Nes.APU, SampleRate);
+}
+
+void Nes_SetAudioStems(Platform_ThreadContext ThreadContext, Bool8 Enable)
+{
+    Emulator *Emu = ThreadContext.ViewPtr;
+    Emu->AudioStemsRequested = Enable;
+}
+
+void Nes_SetAudioLatencyBudget(Platform_ThreadContext ThreadContext, u32 Milliseconds)
+{
+    Emulator *Emu = ThreadContext.ViewPtr;
+    Emu->AudioLatencyBudget = Milliseconds;
+}
+
 void Nes_OnEmulatorReset(Platform_ThreadContext ThreadContext)
 {
     Emulator *Emu = ThreadContext.ViewPtr;
-    Emu->Nes.Clk = 0;
-    MC6502_Reset(&Emu->Nes.CPU);
-    NESPPU_Reset(&Emu->Nes.PPU);
-    NESAPU_Reset(&Emu->Nes.APU);
-    if (Emu->Nes.Cartridge)
-        NESCartridge_Reset(Emu->Nes.Cartridge);
+    /* no arguments, one that's still pending is as good as a new one */
+    if (!(Emu->PendingCommands & EMU_COMMAND_RESET))
+        NesInternal_PostCommand(Emu, EMU_COMMAND_RESET);
+}
+
+void Nes_SetFrameBufferTarget(Platform_ThreadContext ThreadContext, void *Data, isize Pitch, Nes_PixelFormat PixelFormat)
+{
+    Emulator *Emu = ThreadContext.ViewPtr;
+    NesInternal_WaitForCommand(Emu, EMU_COMMAND_SCREEN_TARGET);
+    Emu->TargetScreen = Data;
+    Emu->TargetScreenPitch = Pitch;
+    Emu->TargetScreenFormat = PixelFormat;
+    Emu->FilteredScreenIsValid = false;
+    NesInternal_PostCommand(Emu, EMU_COMMAND_SCREEN_TARGET);
+}
+
+void Nes_SetScaler(Platform_ThreadContext ThreadContext, Nes_Scaler Scaler)
+{
+    Emulator *Emu = ThreadContext.ViewPtr;
+    Emu->Scaler = Scaler;
+    Emu->FilteredScreenIsValid = false;
+}
+
+void Nes_SetNTSCFilter(Platform_ThreadContext ThreadContext, Bool8 Enable)
+{
+    Emulator *Emu = ThreadContext.ViewPtr;
+    Emu->NTSCFilterEnabled = Enable;
+    Emu->FilteredScreenIsValid = false;
+}
+
+void Nes_SetScanlineBand(Platform_ThreadContext ThreadContext, u32 ScanlinesPerBand)
+{
+    Emulator *Emu = ThreadContext.ViewPtr;
+    Emu->ScanlinesPerBandRequested = ScanlinesPerBand;
+}
+
+void Nes_SetPPUThread(Platform_ThreadContext ThreadContext, Bool8 Enable)
+{
+    Emulator *Emu = ThreadContext.ViewPtr;
+    Emu->PPUThreadRequested = Enable;
+}
+
+void Nes_SetFrameSkip(Platform_ThreadContext ThreadContext, u32 SkippedFrames)
+{
+    Emulator *Emu = ThreadContext.ViewPtr;
+    Emu->FrameSkipRequested = SkippedFrames;
+}
+
+void Nes_SetRasterRecorder(Platform_ThreadContext ThreadContext, Bool8 Enable)
+{
+    Emulator *Emu = ThreadContext.ViewPtr;
+    /* the emulator thread turns it on or off between chunks, see NesInternal_RunCommands */
+    Emu->RasterRecorderRequested = Enable;
+}
+
+Nes_AudioStats Nes_PlatformQueryAudioStats(Platform_ThreadContext ThreadContext)
+{
+    Emulator *Emu = ThreadContext.ViewPtr;
+    Nes_AudioStats Stats = Emu->AudioStats;
+    Stats.QueuedSamples = NESAudioRing_Count(&Emu->AudioRing);
+    Stats.LatencyMs = (u64)(Stats.QueuedSamples + Emu->AudioDeviceFrames) * 1000 / Emu->AudioSampleRate;
+    return Stats;
+}
+
+u32 Nes_ReadAudioStem(Platform_ThreadContext ThreadContext, Nes_AudioStem Stem, int16_t *Out, u32 Count)
+{
+    Emulator *Emu = ThreadContext.ViewPtr;
+    DEBUG_ASSERT(IN_RANGE(0, Stem, NES_AUDIO_STEM_COUNT - 1));
+    return NESAudioRing_ReadLatest(&Emu->AudioStems[Stem], Out, Count, AUDIO_STEM_MAX_BACKLOG);
+}
+
+u32 Nes_PlatformQueryRasterLog(Platform_ThreadContext ThreadContext, u32 KnownFrameNumber, Nes_RasterLog *Out)
+{
+    Emulator *Emu = ThreadContext.ViewPtr;
+    if (!Emu->RasterRecorderRequested)
+        return 0;
+
+    const Nes_RasterLog *Log = NESRaster_GetLatestLog(&Emu->RasterRecorder);
+    if (!Log)
+        return 0;
+    if (Log->FrameNumber != KnownFrameNumber)
+    {
+        Out->FrameNumber = Log->FrameNumber;
+        Out->EventCount = Log->EventCount;
+        Out->DroppedEvents = Log->DroppedEvents;
+        Out->MidScanlineWrites = Log->MidScanlineWrites;
+        /* no need to copy the unused part */
+        Memcpy(Out->Events, Log->Events, Log->EventCount * sizeof Log->Events[0]);
+    }
+    return Log->FrameNumber;
 }
 
 void Nes_OnEmulatorTogglePalette(Platform_ThreadContext ThreadContext)
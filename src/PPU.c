@@ -11,8 +11,9 @@
 
 
 typedef struct NESPPU NESPPU;
-typedef void (*NESPPU_FrameCompletionCallback)(void *);
+typedef void (*NESPPU_FrameCompletionCallback)(void *, Bool8 Skipped);
 typedef void (*NESPPU_NmiCallback)(void *);
+typedef void (*NESPPU_ScanlineCallback)(void *, uint FirstScanline, uint ScanlineCount);
 
 /* CTRL */
 #define PPUCTRL_NAMETABLE_X     (1 << 0)
@@ -44,6 +45,9 @@ typedef void (*NESPPU_NmiCallback)(void *);
 #define FINE_Y_MASK 0x7000
 #define TILE_SIZE 16
 
+#define PPU_FRAME_HASH_SEED 0xCBF29CE484222325ull
+#define PPU_FRAME_HASH_PRIME 0x00000100000001B3ull
+
 #define GET_COARSE_X(u16Register) (((u16Register) & COARSE_X_MASK))
 #define GET_COARSE_Y(u16Register) (((u16Register) & COARSE_Y_MASK) >> 5)
 #define GET_NAMETABLE_SELECT(u16Register) (((u16Register) >> 12) & 0x3)
@@ -67,11 +71,33 @@ typedef struct NESPPU_ObjectAttribute
        x;
 } NESPPU_ObjectAttribute;
 
+/* copy of everything the nametable, attribute and sprite viewers are drawn from, 
+ * see NESPPU_TakeSnapshot and NESPPU_TakeChrSnapshot */
+typedef struct NESPPU_Snapshot 
+{
+    u8 Nametables[4][NES_NAMETABLE_SIZE]; /* logical nametables, mirroring already applied */
+    NESPPU_ObjectAttribute OAM[64];
+    u8 PaletteColorIndex[NES_PALETTE_SIZE];
+    u16 Scroll; /* loopy t */
+    u8 FineX;
+    u8 Ctrl;
+    u8 Chr[2 * NES_PATTERN_TABLE_SIZE]; /* both pattern tables, as banked in by the mapper */
+} NESPPU_Snapshot;
+
+/* one pixel of the sprite layer for the next scanline, 
+ * rendered once per scanline instead of shifted out every dot */
+typedef struct NESPPU_SpritePixel 
+{
+    u8 Pixel;
+    u8 Palette;
+    Bool8 PrioritizeForeground;
+    Bool8 IsSpr0;
+} NESPPU_SpritePixel;
+
 struct NESPPU 
 {
     uint Clk;
     int Scanline;
-    u32 ScreenIndex;
 
     /* loopy registers */
     struct {
@@ -104,6 +130,11 @@ struct NESPPU
 
     u8 PaletteColorIndex[NES_PALETTE_SIZE];
     u8 NametableMemory[NES_NAMETABLE_SIZE*2];
+    /* the 4 logical nametables at 0x2000, 0x2400, 0x2800 and 0x2C00, 
+     * each points to 1kb of either NametableMemory or the cartridge's vram, 
+     * recomputed by NESPPU_UpdateNametableLayout */
+    u8 *NametablePages[4];
+    NESNametableMirroring MirroringMode;
     union {
         NESPPU_ObjectAttribute Entries[64];
         u8 Bytes[256];
@@ -111,15 +142,38 @@ struct NESPPU
 
 
     NESPPU_ObjectAttribute VisibleSprites[8];
-    u8 SprPatternLoShifter[8];
-    u8 SprPatternHiShifter[8];
+    NESPPU_SpritePixel SpriteLineBuffer[NES_SCREEN_WIDTH];
     u8 VisibleSpriteCount;
     Bool8 Spr0IsVisible;
 
+    /* frame skipping: only 1 out of every FrameSkip + 1 frames gets composed into ScreenOutput, 
+     * the rest still do every fetch and set every flag, see NESPPU_SetFrameSkip */
+    uint FrameSkip;
+    uint FramesSkipped;
+    Bool8 SkipCurrentFrame;
+
+    /* bumped whenever what NESPPU_GetRGBPalette and NESPPU_GetPatternTables return could have changed 
+     * (palette writes and grayscale toggles, CHR writes), so the debug view can tell when to redraw them */
+    u32 PaletteVersion;
+    u32 ChrVersion;
+
     void *UserData;
     NESPPU_FrameCompletionCallback FrameCompletionCallback;
     NESPPU_NmiCallback NmiCallback;
-    u32 *ScreenOutput;
+    /* optional, called every ScanlinesPerBand visible scanlines (and at the last one) 
+     * as soon as they are in ScreenOutput, see NESPPU_SetScanlineCallback */
+    NESPPU_ScanlineCallback ScanlineCallback;
+    uint ScanlinesPerBand;
+    /* where the pixels go, rows are ScreenPitch bytes apart, see NESPPU_SetScreenOutput */
+    void *ScreenOutput;
+    isize ScreenPitch;
+    Nes_PixelFormat PixelFormat;
+    /* hash of every scanline written to ScreenOutput so far this frame, 
+     * FrameHash is the one of the last complete frame, see NESPPU_GetFrameHash */
+    u64 RunningFrameHash;
+    uint HashedScanlines;
+    u64 FrameHash;
+    Bool8 FrameHashIsValid;
 
     NESCartridge **CartridgeHandle;
 };
@@ -136,6 +190,51 @@ typedef enum NESPPU_CtrlReg
     PPU_DATA,
 } NESPPU_CtrlReg;
 
+
+/* 
+ * what the PPU does on each dot, indexed by scanline class and dot (see NESPPU_InitDotActions), 
+ * this is the timing diagram from https://www.nesdev.org/w/images/default/4/4f/Ppu.svg as data. 
+ * Actions are executed in the order they are declared here, 
+ * conditions that depend on PPU registers (rendering enabled, etc.) are still checked by the actions themselves 
+ */
+typedef enum NESPPU_DotAction 
+{
+    PPU_ACTION_CLEAR_STATUS             = 1 << 0,  /* pre-render: clear spr0 hit, overflow and sprites */
+    PPU_ACTION_RELOAD_Y                 = 1 << 1,  /* pre-render: v.y = t.y */
+    PPU_ACTION_SHIFT_BG                 = 1 << 2,
+    PPU_ACTION_FETCH_NAMETABLE          = 1 << 3,  /* also reloads the background shifters */
+    PPU_ACTION_FETCH_ATTRIBUTE          = 1 << 4,
+    PPU_ACTION_FETCH_PATTERN_LO         = 1 << 5,
+    PPU_ACTION_FETCH_PATTERN_HI         = 1 << 6,
+    PPU_ACTION_INCREMENT_X              = 1 << 7,
+    PPU_ACTION_INCREMENT_Y              = 1 << 8,
+    PPU_ACTION_DUMMY_NAMETABLE_FETCH    = 1 << 9,
+    PPU_ACTION_RESET_OAM_ADDR           = 1 << 10,
+    PPU_ACTION_RELOAD_X                 = 1 << 11, /* v.x = t.x, also reloads the background shifters */
+    PPU_ACTION_EVALUATE_SPRITES         = 1 << 12,
+    PPU_ACTION_LOAD_SPRITES             = 1 << 13,
+    PPU_ACTION_SET_VBLANK               = 1 << 14,
+    PPU_ACTION_OUTPUT_PIXEL             = 1 << 15,
+    PPU_ACTION_END_OF_LINE              = 1 << 16, /* the last pixel of the scanline is out */
+} NESPPU_DotAction;
+
+typedef enum NESPPU_ScanlineClass 
+{
+    PPU_SCANLINE_PRERENDER = 0,     /* -1 (261) */
+    PPU_SCANLINE_VISIBLE,           /* 0..239 */
+    PPU_SCANLINE_IDLE,              /* 240, 242..260 */
+    PPU_SCANLINE_VBLANK_START,      /* 241 */
+    PPU_SCANLINE_CLASS_COUNT,
+} NESPPU_ScanlineClass;
+
+#define PPU_DOTS_PER_SCANLINE 341
+#define PPU_SCANLINES_PER_FRAME 262
+#define PPU_VBLANK_CLEAR_CLK (4*(2270 + 199)) /* magic */
+
+static u32 sPPUDotActions[PPU_SCANLINE_CLASS_COUNT][PPU_DOTS_PER_SCANLINE];
+static u8 sPPUScanlineClass[PPU_SCANLINES_PER_FRAME]; /* indexed by Scanline + 1 */
+static Bool8 sPPUDotActionsInitialized = false;
+
 static u32 sPPURGBPalette[] = {
     0x00545454,
     0x00001E74,
@@ -208,6 +307,80 @@ static u32 sPPURGBPalette[] = {
 
 
 
+static void NESPPU_InitDotActions(void)
+{
+    if (sPPUDotActionsInitialized)
+        return;
+
+    for (int Scanline = -1; Scanline < PPU_SCANLINES_PER_FRAME - 1; Scanline++)
+    {
+        NESPPU_ScanlineClass Class = PPU_SCANLINE_IDLE;
+        if (Scanline == -1)
+            Class = PPU_SCANLINE_PRERENDER;
+        else if (IN_RANGE(0, Scanline, NES_SCREEN_HEIGHT - 1))
+            Class = PPU_SCANLINE_VISIBLE;
+        else if (Scanline == 241)
+            Class = PPU_SCANLINE_VBLANK_START;
+        sPPUScanlineClass[Scanline + 1] = Class;
+    }
+
+    /* pre-render and visible scanlines share the same fetch pattern */
+    for (int Class = PPU_SCANLINE_PRERENDER; Class <= PPU_SCANLINE_VISIBLE; Class++)
+    {
+        u32 *Actions = sPPUDotActions[Class];
+        for (uint Clk = 0; Clk < PPU_DOTS_PER_SCANLINE; Clk++)
+        {
+            u32 Action = 0;
+
+            /* fetching data cycles */
+            if (IN_RANGE(2, Clk, 256) || IN_RANGE(321, Clk, 337))
+            {
+                static const u32 FetchActions[8] = {
+                    PPU_ACTION_FETCH_NAMETABLE, 0, 
+                    PPU_ACTION_FETCH_ATTRIBUTE, 0, 
+                    PPU_ACTION_FETCH_PATTERN_LO, 0, 
+                    PPU_ACTION_FETCH_PATTERN_HI, PPU_ACTION_INCREMENT_X,
+                };
+                Action |= PPU_ACTION_SHIFT_BG | FetchActions[(Clk - 1) % 8];
+                if (Clk == 256) /* end of visible frame, update y components */
+                    Action |= PPU_ACTION_INCREMENT_Y;
+            }
+            /* horizontal blank: 257..320 */
+            if (IN_RANGE(257, Clk, 320))
+                Action |= PPU_ACTION_RESET_OAM_ADDR;
+            if (Clk == 257) /* horizontal blank entry */
+                Action |= PPU_ACTION_RELOAD_X;
+            /* horizontal blank ends: dummy fetches */
+            if (Clk == 337 || Clk == 339)
+                Action |= PPU_ACTION_DUMMY_NAMETABLE_FETCH;
+
+            /* sprites for the next scanline */
+            if (Clk == 257 && Class == PPU_SCANLINE_VISIBLE)
+                Action |= PPU_ACTION_EVALUATE_SPRITES;
+            if (Clk == 340)
+                Action |= PPU_ACTION_LOAD_SPRITES;
+
+            if (Class == PPU_SCANLINE_PRERENDER)
+            {
+                if (Clk == 1)
+                    Action |= PPU_ACTION_CLEAR_STATUS;
+                else if (IN_RANGE(280, Clk, 304)) /* constantly reload y components */
+                    Action |= PPU_ACTION_RELOAD_Y;
+            }
+            else if (IN_RANGE(1, Clk, NES_SCREEN_WIDTH))
+            {
+                Action |= PPU_ACTION_OUTPUT_PIXEL;
+                if (Clk == NES_SCREEN_WIDTH)
+                    Action |= PPU_ACTION_END_OF_LINE;
+            }
+            Actions[Clk] = Action;
+        }
+    }
+    sPPUDotActions[PPU_SCANLINE_VBLANK_START][1] = PPU_ACTION_SET_VBLANK;
+
+    sPPUDotActionsInitialized = true;
+}
+
 NESPPU NESPPU_Init(
     void *UserData,
     NESPPU_FrameCompletionCallback FrameCallback, 
@@ -217,11 +390,15 @@ NESPPU NESPPU_Init(
 {
     NESPPU This = {
         .ScreenOutput = BackBuffer,
+        .ScreenPitch = NES_SCREEN_WIDTH * sizeof(u32),
+        .PixelFormat = NES_PIXELFORMAT_XRGB8888,
+        .RunningFrameHash = PPU_FRAME_HASH_SEED,
         .FrameCompletionCallback = FrameCallback,
         .NmiCallback = NmiCallback,
         .CartridgeHandle = CartridgeHandle,
         .UserData = UserData,
     };
+    NESPPU_InitDotActions();
     for (uint i = 0; i < STATIC_ARRAY_SIZE(This.PaletteColorIndex); i++)
     {
         This.PaletteColorIndex[i] = i;
@@ -237,25 +414,77 @@ void NESPPU_Reset(NESPPU *This)
     This->ReadBuffer = 0;
     This->Ctrl = 0;
     This->Mask = 0;
+    This->PaletteVersion++;
+    This->ChrVersion++;
     This->Loopy.w = 0;
     This->CurrentFrameIsOdd = false;
     This->VisibleSpriteCount = 0;
     This->SupressNMIThisFrame = false;
     This->ShouldNotSetVBlankThisFrame = false;
     Memset(This->VisibleSprites, 0xFF, sizeof This->VisibleSprites);
+    Memset(This->SpriteLineBuffer, 0, sizeof This->SpriteLineBuffer);
 
-    This->ScreenIndex = 0;
+    This->FramesSkipped = 0;
+    This->SkipCurrentFrame = false;
+
+    This->RunningFrameHash = PPU_FRAME_HASH_SEED;
+    This->HashedScanlines = 0;
+    This->FrameHashIsValid = false;
 }
 
+/* hash of the pixels of the last frame written to ScreenOutput, only meaningful during and after the frame completion callback, 
+ * returns false if there isn't one (the frame was cut short by a reset) */
+Bool8 NESPPU_GetFrameHash(const NESPPU *This, u64 *Hash)
+{
+    *Hash = This->FrameHash;
+    return This->FrameHashIsValid;
+}
 
+void NESPPU_SetScreenOutput(NESPPU *This, void *ScreenOutput, isize Pitch, Nes_PixelFormat PixelFormat)
+{
+    DEBUG_ASSERT(ScreenOutput);
+    This->ScreenOutput = ScreenOutput;
+    This->ScreenPitch = Pitch;
+    This->PixelFormat = PixelFormat;
+}
+
+void NESPPU_SetScanlineCallback(NESPPU *This, NESPPU_ScanlineCallback Callback, uint ScanlinesPerBand)
+{
+    /* NULL or 0 scanlines per band disables it */
+    if (!Callback || !ScanlinesPerBand)
+    {
+        Callback = NULL;
+        ScanlinesPerBand = 0;
+    }
+    This->ScanlineCallback = Callback;
+    This->ScanlinesPerBand = ScanlinesPerBand;
+}
 
-static u16 NESPPU_MirrorNametableAddr(NESCartridge **CartridgeHandle, u16 LogicalAddress)
+void NESPPU_SetFrameSkip(NESPPU *This, uint FrameSkip)
+{
+    /* takes effect from the next frame */
+    This->FrameSkip = FrameSkip;
+    if (This->FramesSkipped > FrameSkip)
+        This->FramesSkipped = FrameSkip;
+}
+
+
+
+/* must be called when the PPU is at its final memory location, 
+ * or when the cartridge or its mapper changes the mirroring mode */
+void NESPPU_UpdateNametableLayout(NESPPU *This)
 {
     NESNametableMirroring MirroringMode = NAMETABLE_VERTICAL;
-    if (CartridgeHandle && *CartridgeHandle)
-        MirroringMode = (*CartridgeHandle)->MirroringMode;
+    u8 *CartridgeVRam = NULL;
+    if (This->CartridgeHandle && *This->CartridgeHandle)
+    {
+        MirroringMode = (*This->CartridgeHandle)->MirroringMode;
+        CartridgeVRam = (*This->CartridgeHandle)->NametableVRam;
+    }
 
-    u16 PhysicalAddress = 0;
+    u8 *Lo = &This->NametableMemory[0];
+    u8 *Hi = &This->NametableMemory[NES_NAMETABLE_SIZE];
+    This->MirroringMode = MirroringMode;
     switch (MirroringMode)
     {
     case NAMETABLE_VERTICAL: 
@@ -269,7 +498,10 @@ static u16 NESPPU_MirrorNametableAddr(NESCartridge **CartridgeHandle, u16 Logica
          *    |     0     |     1     |     0     |     1     |
          *    *-----------*-----------*-----------*-----------*
          */
-        PhysicalAddress = LogicalAddress % (NES_NAMETABLE_SIZE*2);
+        This->NametablePages[0] = Lo;
+        This->NametablePages[1] = Hi;
+        This->NametablePages[2] = Lo;
+        This->NametablePages[3] = Hi;
     } break;
     case NAMETABLE_HORIZONTAL:
     {
@@ -282,22 +514,49 @@ static u16 NESPPU_MirrorNametableAddr(NESCartridge **CartridgeHandle, u16 Logica
          *    |     0     |     0     |     1     |     1     |
          *    *-----------*-----------*-----------*-----------*
          */
-        PhysicalAddress = LogicalAddress % NES_NAMETABLE_SIZE;
-        if (IN_RANGE(0x0800, LogicalAddress, 0x0FFF))
-        {
-            PhysicalAddress += NES_NAMETABLE_SIZE;
-        }
+        This->NametablePages[0] = Lo;
+        This->NametablePages[1] = Lo;
+        This->NametablePages[2] = Hi;
+        This->NametablePages[3] = Hi;
     } break;
     case NAMETABLE_ONESCREEN_LO:
     {
-        PhysicalAddress = LogicalAddress % NES_NAMETABLE_SIZE;
+        This->NametablePages[0] = Lo;
+        This->NametablePages[1] = Lo;
+        This->NametablePages[2] = Lo;
+        This->NametablePages[3] = Lo;
     } break;
     case NAMETABLE_ONESCREEN_HI:
     {
-        PhysicalAddress = (LogicalAddress % NES_NAMETABLE_SIZE) + NES_NAMETABLE_SIZE;
+        This->NametablePages[0] = Hi;
+        This->NametablePages[1] = Hi;
+        This->NametablePages[2] = Hi;
+        This->NametablePages[3] = Hi;
+    } break;
+    case NAMETABLE_FOURSCREEN:
+    {
+        /*
+         * Logical:
+         * 0x0000 ---- 0x0400 ---- 0x0800 ---- 0x0C00 ---- 0x1000 
+         *    |     0     |     1     |     2     |     3     |
+         *    *-----------*-----------*-----------*-----------*
+         * Physical:
+         *    |   PPU 0   |   PPU 1   |  CART 0   |  CART 1   |
+         *    *-----------*-----------*-----------*-----------*
+         */
+        DEBUG_ASSERT(CartridgeVRam);
+        This->NametablePages[0] = Lo;
+        This->NametablePages[1] = Hi;
+        This->NametablePages[2] = CartridgeVRam;
+        This->NametablePages[3] = CartridgeVRam + NES_NAMETABLE_SIZE;
     } break;
     }
-    return PhysicalAddress;
+}
+
+static u8 *NESPPU_GetNametableByte(NESPPU *This, u16 Address)
+{
+    /* 0x2000..0x2FFF, also mirrored at 0x3000..0x3EFF */
+    return &This->NametablePages[(Address >> 10) & 0x3][Address & (NES_NAMETABLE_SIZE - 1)];
 }
 
 
@@ -316,8 +575,7 @@ static u8 NESPPU_ReadInternalMemory(NESPPU *This, u16 Address)
     /* NOTE: PPU VRAM, but cartridge can also hijack these addresses through mappers */
     else if (IN_RANGE(0x2000, Address, 0x3EFF)) 
     {
-        Address = NESPPU_MirrorNametableAddr(This->CartridgeHandle, Address & 0x0FFF);
-        return This->NametableMemory[Address];
+        return *NESPPU_GetNametableByte(This, Address);
     }
     else /* 0x3F00-0x3FFF: sprite palette, image palette */
     {
@@ -341,13 +599,13 @@ static void NESPPU_WriteInternalMemory(NESPPU *This, u16 Address, u8 Byte)
         if (This->CartridgeHandle && *This->CartridgeHandle)
         {
             NESCartridge_PPUWrite(*This->CartridgeHandle, Address, Byte);
+            This->ChrVersion++;
         }
     }
     /* NOTE: PPU VRAM, but cartridge can also hijack these addresses thorugh mappers */
     else if (IN_RANGE(0x2000, Address, 0x3EFF)) 
     {
-        Address = NESPPU_MirrorNametableAddr(This->CartridgeHandle, Address & 0x0FFF);
-        This->NametableMemory[Address] = Byte;
+        *NESPPU_GetNametableByte(This, Address) = Byte;
     }
     else /* 0x3F00-0x3FFF: sprite palette, image palette */
     {
@@ -359,11 +617,12 @@ static void NESPPU_WriteInternalMemory(NESPPU *This, u16 Address, u8 Byte)
         else if ((Address & 0x0003) == 0)
             Address &= 0x0F;
         This->PaletteColorIndex[Address] = Byte;
+        This->PaletteVersion++;
     }
 }
 
 
-static u32 NESPPU_GetRGBFromPixelAndPalette(NESPPU *This, u8 Pixel, u8 Palette)
+static u8 NESPPU_GetColorIndex(NESPPU *This, u8 Pixel, u8 Palette)
 {
     /* take 2 lower bits only */
     Pixel &= 0x3;
@@ -372,7 +631,12 @@ static u32 NESPPU_GetRGBFromPixelAndPalette(NESPPU *This, u8 Pixel, u8 Palette)
     u16 PaletteBase = 0x3F00;
     u16 PaletteIndex = (Palette << 2) | Pixel;
     u8 ColorIndex = NESPPU_ReadInternalMemory(This, PaletteBase + PaletteIndex);
-    return sPPURGBPalette[ColorIndex % STATIC_ARRAY_SIZE(sPPURGBPalette)];
+    return ColorIndex % STATIC_ARRAY_SIZE(sPPURGBPalette);
+}
+
+static u32 NESPPU_GetRGBFromPixelAndPalette(NESPPU *This, u8 Pixel, u8 Palette)
+{
+    return sPPURGBPalette[NESPPU_GetColorIndex(This, Pixel, Palette)];
 }
 
 
@@ -443,6 +707,31 @@ Bool8 NESPPU_GetPatternTables(NESPPU *This,
     return true;
 }
 
+void NESPPU_TakeSnapshot(const NESPPU *This, NESPPU_Snapshot *Snapshot)
+{
+    for (uint i = 0; i < 4; i++)
+    {
+        Memcpy(Snapshot->Nametables[i], This->NametablePages[i], NES_NAMETABLE_SIZE);
+    }
+    Memcpy(Snapshot->OAM, This->OAM.Entries, sizeof Snapshot->OAM);
+    Memcpy(Snapshot->PaletteColorIndex, This->PaletteColorIndex, sizeof Snapshot->PaletteColorIndex);
+    /* taken at the end of vblank, so t already holds the scroll the next frame starts with */
+    Snapshot->Scroll = This->Loopy.t;
+    Snapshot->FineX = This->Loopy.x;
+    Snapshot->Ctrl = This->Ctrl;
+}
+
+/* the slow part of a snapshot, only worth doing when ChrVersion or the cartridge changed */
+void NESPPU_TakeChrSnapshot(const NESPPU *This, NESPPU_Snapshot *Snapshot)
+{
+    /* CHR is read without side effects on the mapper */
+    NESCartridge *Cartridge = This->CartridgeHandle? *This->CartridgeHandle : NULL;
+    for (uint i = 0; i < sizeof Snapshot->Chr; i++)
+    {
+        Snapshot->Chr[i] = Cartridge? NESCartridge_DebugPPURead(Cartridge, i) : 0;
+    }
+}
+
 
 
 u8 NESPPU_ExternalRead(NESPPU *This, u16 Address)
@@ -525,7 +814,12 @@ void NESPPU_ExternalWrite(NESPPU *This, u16 Address, u8 Byte)
             This->NmiCallback(This->UserData);
         }
     } break;
-    case PPU_MASK: This->Mask = Byte; break;
+    case PPU_MASK: 
+    {
+        if ((This->Mask ^ Byte) & PPUMASK_GRAYSCALE)
+            This->PaletteVersion++;
+        This->Mask = Byte;
+    } break;
     case PPU_STATUS: /* write not allowed */ break;
     case PPU_OAM_ADDR:
     {
@@ -591,23 +885,6 @@ void NESPPU_UpdateShifters(NESPPU *This)
         This->BgAttrHiShifter <<= 1;
         This->BgAttrLoShifter <<= 1;
     }
-
-    if ((This->Mask & PPUMASK_SHOW_SPR) && IN_RANGE(1, This->Clk, 256))
-    {
-        for (uint i = 0; i < This->VisibleSpriteCount; i++)
-        {
-            /* wait until we arrived at the sprite to render */
-            if (This->VisibleSprites[i].x > 0)
-            {
-                This->VisibleSprites[i].x--;
-            }
-            else
-            {
-                This->SprPatternHiShifter[i] <<= 1;
-                This->SprPatternLoShifter[i] <<= 1;
-            }
-        }
-    }
 }
 
 static void NESPPU_ReloadBackgroundShifters(NESPPU *This)
@@ -627,28 +904,40 @@ static void NESPPU_ReloadBackgroundShifters(NESPPU *This)
     }
 }
 
-static Bool8 NESPPU_ShouldRenderBackground(NESPPU *This)
+static Bool8 NESPPU_ShouldRenderBackground(const NESPPU *This, uint Clk)
 {
     Bool8 ShouldRender = (This->Mask & PPUMASK_SHOW_BG) != 0;
     Bool8 ShouldRenderEdge = true;
     if ((This->Mask & PPUMASK_SHOW_BG_LEFT) == 0)
-        ShouldRenderEdge = This->Clk < 9;
+        ShouldRenderEdge = Clk < 9;
     return ShouldRender && ShouldRenderEdge;
 }
 
-static Bool8 NESPPU_ShouldRenderForeground(NESPPU *This)
+static Bool8 NESPPU_ShouldRenderForeground(const NESPPU *This, uint Clk)
 {
     Bool8 ShouldRender = (This->Mask & PPUMASK_SHOW_SPR) != 0;
     Bool8 ShouldRenderEdge = true;
     if ((This->Mask & PPUMASK_SHOW_SPR_LEFT) == 0)
-        ShouldRenderEdge = This->Clk < 9;
+        ShouldRenderEdge = Clk < 9;
     return ShouldRender && ShouldRenderEdge;
 }
 
+/* spr 0 hit, very specific conditions (other than both pixels being opaque) */
+static Bool8 NESPPU_CanHitSpr0At(const NESPPU *This, uint Clk)
+{
+    Bool8 IsAtEdge = false;
+    if (This->Mask & (PPUMASK_SHOW_BG_LEFT | PPUMASK_SHOW_SPR_LEFT))
+        IsAtEdge = Clk == 1 || Clk == 8;
+    return Clk != 255 
+        && !IsAtEdge
+        && NESPPU_ShouldRenderForeground(This, Clk) 
+        && NESPPU_ShouldRenderBackground(This, Clk);
+}
+
 static void NESPPU_RenderSinglePixel(NESPPU *This)
 {
-    Bool8 ShouldRenderBackground = NESPPU_ShouldRenderBackground(This);
-    Bool8 ShouldRenderForeground = NESPPU_ShouldRenderForeground(This);
+    Bool8 ShouldRenderBackground = NESPPU_ShouldRenderBackground(This, This->Clk);
+    Bool8 ShouldRenderForeground = NESPPU_ShouldRenderForeground(This, This->Clk);
 
     /* get background pixel values from shift registers */
     u8 BackgroundPixel = 0;
@@ -667,39 +956,18 @@ static void NESPPU_RenderSinglePixel(NESPPU *This)
     }
 
 
-    /* get foreground (sprite) pixel values */
+    /* get foreground (sprite) pixel values from the line buffer */
     u8 ForegroundPixel = 0;
     u8 ForegroundPalette = 0;
     Bool8 PrioritizeForeground = 0;
     Bool8 RenderingSpr0 = false;
-    if (ShouldRenderForeground)
+    if (ShouldRenderForeground && IN_RANGE(1, This->Clk, NES_SCREEN_WIDTH))
     {
-        for (uint i = 0; i < This->VisibleSpriteCount; i++)
-        {
-            NESPPU_ObjectAttribute *CurrentSprite = &This->VisibleSprites[i];
-            /* in the process of rendering */
-            if (CurrentSprite->x == 0)
-            {
-                u8 LowBitOfPixel = (This->SprPatternLoShifter[i] >> 7) & 0x1;
-                u8 HighBitOfPixel = (This->SprPatternHiShifter[i] >> 7) & 0x1;
-
-                ForegroundPixel = LowBitOfPixel | (HighBitOfPixel << 1);
-                ForegroundPalette = (CurrentSprite->Attribute & PPU_OA_PALETTE) | 0x04; /* foreground offset into palette */
-                PrioritizeForeground = (CurrentSprite->Attribute & PPU_OA_PRIORITIZE_FOREGROUND) == 0;
-
-                /* foreground (sprite) is visible, and since the earlier the sprite is, 
-                 * the higher the priority it has, so we render it while
-                 * discarding other sprites that come after it in the VisibleSprites buffer */
-                if (ForegroundPixel != 0)
-                {
-                    RenderingSpr0 = i == 0 && This->Spr0IsVisible;
-                    break;
-                }
-
-                /* otherwise the sprite is transparent and we keep looking 
-                 * for a nontransparent sprite to render */
-            }
-        }
+        const NESPPU_SpritePixel *SpritePixel = &This->SpriteLineBuffer[This->Clk - 1];
+        ForegroundPixel = SpritePixel->Pixel;
+        ForegroundPalette = SpritePixel->Palette;
+        PrioritizeForeground = SpritePixel->PrioritizeForeground;
+        RenderingSpr0 = SpritePixel->IsSpr0;
     }
 
 
@@ -709,15 +977,7 @@ static void NESPPU_RenderSinglePixel(NESPPU *This)
     u8 Palette = 0;
     if (BackgroundPixel && ForegroundPixel)
     {
-        /* spr 0 hit, very specific conditions */
-        Bool8 IsAtEdge = false;
-        if (This->Mask & (PPUMASK_SHOW_BG_LEFT | PPUMASK_SHOW_SPR_LEFT))
-            IsAtEdge = This->Clk == 1 || This->Clk == 8;
-        if (RenderingSpr0 
-        && This->Clk != 255 
-        && !IsAtEdge
-        && ShouldRenderForeground 
-        && ShouldRenderBackground)
+        if (RenderingSpr0 && NESPPU_CanHitSpr0At(This, This->Clk))
         {
             This->Status |= PPUSTATUS_SPR0_HIT;
         }
@@ -747,22 +1007,72 @@ static void NESPPU_RenderSinglePixel(NESPPU *This)
     }
 
 
-    if (IN_RANGE(1, This->Clk, NES_SCREEN_WIDTH) 
-    && IN_RANGE(0, This->Scanline, NES_SCREEN_HEIGHT - 1))
+    u8 ColorIndex = NESPPU_GetColorIndex(This, Pixel, Palette);
+    u32 Color = sPPURGBPalette[ColorIndex];
+    u8 *Row = (u8 *)This->ScreenOutput + This->Scanline * This->ScreenPitch;
+    uint x = This->Clk - 1;
+    switch (This->PixelFormat)
     {
-        u32 Color = NESPPU_GetRGBFromPixelAndPalette(This, Pixel, Palette);
-        This->ScreenOutput[This->ScreenIndex++] = Color;
-        if (This->ScreenIndex >= NES_SCREEN_BUFFER_SIZE)
-            This->ScreenIndex = 0;
+    case NES_PIXELFORMAT_PALETTE_INDEX:
+    {
+        /* emphasis bits (red, green, blue) on top of the color index */
+        ((u16 *)Row)[x] = ColorIndex | ((u16)(This->Mask >> 5) << 6);
+    } break;
+    case NES_PIXELFORMAT_XRGB8888:
+    {
+        ((u32 *)Row)[x] = Color;
+    } break;
+    case NES_PIXELFORMAT_ABGR8888:
+    {
+        ((u32 *)Row)[x] = 0xFF000000 
+            | ((Color & 0xFF) << 16) 
+            | (Color & 0xFF00) 
+            | ((Color >> 16) & 0xFF);
+    } break;
+    case NES_PIXELFORMAT_RGB565:
+    {
+        ((u16 *)Row)[x] = 
+            ((Color >> 8) & 0xF800)     /* 5 bits of red */
+            | ((Color >> 5) & 0x07E0)   /* 6 bits of green */
+            | ((Color >> 3) & 0x001F);  /* 5 bits of blue */
+    } break;
     }
 }
 
-static void NESPPU_FetchBackgroundData(NESPPU *This)
+static void NESPPU_HashScanline(NESPPU *This)
 {
-    NESPPU_UpdateShifters(This);
-    switch ((This->Clk - 1) % 8)
+    /* FNV-1a, but a pixel at a time instead of a byte at a time */
+    u64 Hash = This->RunningFrameHash;
+    const u8 *Row = (const u8 *)This->ScreenOutput + This->Scanline * This->ScreenPitch;
+    if (This->PixelFormat == NES_PIXELFORMAT_XRGB8888 || This->PixelFormat == NES_PIXELFORMAT_ABGR8888)
     {
-    case 0: /* fetch nametable byte */
+        for (uint x = 0; x < NES_SCREEN_WIDTH; x++)
+            Hash = (Hash ^ ((const u32 *)Row)[x]) * PPU_FRAME_HASH_PRIME;
+    }
+    else
+    {
+        for (uint x = 0; x < NES_SCREEN_WIDTH; x++)
+            Hash = (Hash ^ ((const u16 *)Row)[x]) * PPU_FRAME_HASH_PRIME;
+    }
+    This->RunningFrameHash = Hash;
+    This->HashedScanlines++;
+}
+
+static void NESPPU_DetectSpr0Hit(NESPPU *This)
+{
+    /* NESPPU_RenderSinglePixel without the pixel, for frames that are skipped */
+    const NESPPU_SpritePixel *SpritePixel = &This->SpriteLineBuffer[This->Clk - 1];
+    if (!SpritePixel->IsSpr0 || !NESPPU_CanHitSpr0At(This, This->Clk))
+        return;
+
+    u16 FineXSelect = 0x8000 >> This->Loopy.x;
+    if ((This->BgPatternLoShifter | This->BgPatternHiShifter) & FineXSelect)
+        This->Status |= PPUSTATUS_SPR0_HIT;
+}
+
+static void NESPPU_FetchBackgroundData(NESPPU *This, u32 Actions)
+{
+    if (Actions & PPU_ACTION_FETCH_NAMETABLE) /* fetch nametable byte */
     {
         NESPPU_ReloadBackgroundShifters(This);
         /* addr: 0010 NN yyyyy xxxxx 
@@ -772,9 +1082,9 @@ static void NESPPU_FetchBackgroundData(NESPPU *This)
          *                     ^^^^^ --- coarse x
          */
         u16 NametableAddr = NAMETABLE_OFFSET + (This->Loopy.v & 0x0FFF);
-        This->BgNametableByteLatch = NESPPU_ReadInternalMemory(This, NametableAddr);
-    } break;
-    case 2: /* fetch tile attribute from the nametable byte above */
+        This->BgNametableByteLatch = *NESPPU_GetNametableByte(This, NametableAddr);
+    }
+    else if (Actions & PPU_ACTION_FETCH_ATTRIBUTE) /* fetch tile attribute from the nametable byte above */
     {
         /* addr: 0010 NN 1111 yyy xxx
          *       ^^^^ ------------------ NAMETABLE_OFFSET (0x2000)
@@ -793,15 +1103,15 @@ static void NESPPU_FetchBackgroundData(NESPPU *This)
             | NametableSelect 
             | ((CoarseY >> 2) << 3) 
             | (CoarseX >> 2);
-        u8 AttrByte = NESPPU_ReadInternalMemory(This, Address);
+        u8 AttrByte = *NESPPU_GetNametableByte(This, Address);
 
         if (CoarseX & (1 << 1))
             AttrByte >>= 2;
         if (CoarseY & (1 << 1))
             AttrByte >>= 4;
         This->BgAttrBitsLatch = AttrByte & 0x3;
-    } break;
-    case 4: /* fetch pattern low bit */
+    }
+    else if (Actions & PPU_ACTION_FETCH_PATTERN_LO) /* fetch pattern low bit */
     {
         u16 BaseAddress = This->Ctrl & PPUCTRL_BG_PATTERN_ADDR? 0x1000 : 0x0000;
         u16 Index       = (u16)This->BgNametableByteLatch * TILE_SIZE;
@@ -810,8 +1120,8 @@ static void NESPPU_FetchBackgroundData(NESPPU *This)
         This->BgPatternLoLatch = NESPPU_ReadInternalMemory(This, 
             BaseAddress | Index | TileOffset
         );
-    } break;
-    case 6: /* fetch pattern high bit */
+    }
+    else if (Actions & PPU_ACTION_FETCH_PATTERN_HI) /* fetch pattern high bit */
     {
         u16 BaseAddress = This->Ctrl & PPUCTRL_BG_PATTERN_ADDR? 0x1000 : 0x0000;
         u16 Index       = (u16)This->BgNametableByteLatch * TILE_SIZE;
@@ -820,8 +1130,8 @@ static void NESPPU_FetchBackgroundData(NESPPU *This)
         This->BgPatternHiLatch = NESPPU_ReadInternalMemory(This, 
             BaseAddress | Index | TileOffset
         );
-    } break;
-    case 7: /* end of tile: update x scroll */
+    }
+    else if (Actions & PPU_ACTION_INCREMENT_X) /* end of tile: update x scroll */
     {
         if (This->Mask & (PPUMASK_SHOW_BG | PPUMASK_SHOW_SPR))
         {
@@ -837,59 +1147,74 @@ static void NESPPU_FetchBackgroundData(NESPPU *This)
             /* reloads CoarseX */
             MASKED_LOAD(This->Loopy.v, NewCoarseX, COARSE_X_MASK);
         }
-    } break;
     }
 }
 
 
+/* returns the address of the low pattern byte of the sprite's row that is visible on the scanline after Scanline */
+static u16 NESPPU_GetSpritePatternAddr(const NESPPU *This, const NESPPU_ObjectAttribute *Sprite, int Scanline)
+{
+    int CurrentHeight = Scanline - Sprite->y;
+
+    /* get low sprite addresses */
+    u16 SprPatternAddrLo;
+    /* 8x16 */
+    if (This->Ctrl & PPUCTRL_SPR_SIZE16)
+    {
+        u16 BaseAddr = (u16)(Sprite->ID & 0x1) << 12; /* first bit determines the pattern table location */
+        uint IsLowerTile = CurrentHeight >= 8;
+        u16 SpriteIndex = (u16)(Sprite->ID & 0xFE) + IsLowerTile;
+        if (IsLowerTile) 
+            CurrentHeight -= 8;
+        u16 PatternSelect = Sprite->Attribute & PPU_OA_FLIP_VERTICAL
+            ? (7 - CurrentHeight)
+            : CurrentHeight;
+
+        SprPatternAddrLo = 
+            BaseAddr 
+            | (SpriteIndex * TILE_SIZE)
+            | (PatternSelect & 0x7);
+    }
+    /* 8x8 */
+    else
+    {
+        u16 BaseAddr = This->Ctrl & PPUCTRL_SPR_PATTERN_ADDR 
+            ? 0x1000 : 0x0000;
+        u16 SpriteIndex = Sprite->ID;
+        u16 PatternSelect = Sprite->Attribute & PPU_OA_FLIP_VERTICAL 
+            ? (7 - CurrentHeight)
+            : CurrentHeight;
+
+        SprPatternAddrLo = 
+            BaseAddr 
+            | (SpriteIndex * TILE_SIZE) 
+            | (PatternSelect & 0x7);
+        /* NOTE: scanline - spr.y is never greater than 7 */
+    }
+    return SprPatternAddrLo;
+}
+
 static void NESPPU_LoadSpriteData(NESPPU *This)
 {
+    /* render the sprites of the next scanline into the line buffer, 
+     * pixel 0 means no sprite covers that spot */
+    Memset(This->SpriteLineBuffer, 0, sizeof This->SpriteLineBuffer);
     for (uint i = 0; i < This->VisibleSpriteCount; i++)
     {
         NESPPU_ObjectAttribute *CurrentSprite = &This->VisibleSprites[i];
-        int CurrentHeight = This->Scanline - CurrentSprite->y;
-
-        /* get low sprite addresses */
-        u16 SprPatternAddrLo, SprPatternAddrHi;
-        /* 8x16 */
-        if (This->Ctrl & PPUCTRL_SPR_SIZE16)
-        {
-            u16 BaseAddr = (u16)(CurrentSprite->ID & 0x1) << 12; /* first bit determines the pattern table location */
-            uint IsLowerTile = CurrentHeight >= 8;
-            u16 SpriteIndex = (u16)(CurrentSprite->ID & 0xFE) + IsLowerTile;
-            if (IsLowerTile) 
-                CurrentHeight -= 8;
-            u16 PatternSelect = CurrentSprite->Attribute & PPU_OA_FLIP_VERTICAL
-                ? (7 - CurrentHeight)
-                : CurrentHeight;
-
-            SprPatternAddrLo = 
-                BaseAddr 
-                | (SpriteIndex * TILE_SIZE)
-                | (PatternSelect & 0x7);
-        }
-        /* 8x8 */
-        else
-        {
-            u16 BaseAddr = This->Ctrl & PPUCTRL_SPR_PATTERN_ADDR 
-                ? 0x1000 : 0x0000;
-            u16 SpriteIndex = CurrentSprite->ID;
-            u16 PatternSelect = CurrentSprite->Attribute & PPU_OA_FLIP_VERTICAL 
-                ? (7 - CurrentHeight)
-                : CurrentHeight;
-
-            SprPatternAddrLo = 
-                BaseAddr 
-                | (SpriteIndex * TILE_SIZE) 
-                | (PatternSelect & 0x7);
-            /* NOTE: scanline - spr.y is never greater than 7 */
-        }
+        u16 SprPatternAddrLo = NESPPU_GetSpritePatternAddr(This, CurrentSprite, This->Scanline);
+        u16 SprPatternAddrHi;
 
         /* hi and lo tiles are generally 8 bytes apart in the NES */
         SprPatternAddrHi = SprPatternAddrLo + 8;
         u8 SprPatternBitsLo = NESPPU_ReadInternalMemory(This, SprPatternAddrLo);
         u8 SprPatternBitsHi = NESPPU_ReadInternalMemory(This, SprPatternAddrHi);
 
+        /* the fetches above are visible to the mapper and must happen, 
+         * but when the frame is skipped only sprite 0 matters (for spr0 hit) */
+        if (This->SkipCurrentFrame && !(i == 0 && This->Spr0IsVisible))
+            continue;
+
         /* flips a sprite horizontally */
         /* reverse the bit pattern */
         if (CurrentSprite->Attribute & PPU_OA_FLIP_HORIZONTAL) 
@@ -898,9 +1223,28 @@ static void NESPPU_LoadSpriteData(NESPPU *This)
             SprPatternBitsHi = FlipByte(SprPatternBitsHi);
         }
 
-        /* load them into the shift registers */
-        This->SprPatternLoShifter[i] = SprPatternBitsLo;
-        This->SprPatternHiShifter[i] = SprPatternBitsHi;
+        /* draw the sprite into the line buffer, the earlier the sprite is in VisibleSprites, 
+         * the higher the priority it has, so only transparent spots can be drawn over */
+        NESPPU_SpritePixel SpritePixel = {
+            .Palette = (CurrentSprite->Attribute & PPU_OA_PALETTE) | 0x04, /* foreground offset into palette */
+            .PrioritizeForeground = (CurrentSprite->Attribute & PPU_OA_PRIORITIZE_FOREGROUND) == 0,
+            .IsSpr0 = i == 0 && This->Spr0IsVisible,
+        };
+        for (uint x = CurrentSprite->x; 
+            x < (uint)CurrentSprite->x + 8 && x < NES_SCREEN_WIDTH; 
+            x++)
+        {
+            u8 LowBitOfPixel = (SprPatternBitsLo >> 7) & 0x1;
+            u8 HighBitOfPixel = (SprPatternBitsHi >> 7) & 0x1;
+            SprPatternBitsLo <<= 1;
+            SprPatternBitsHi <<= 1;
+
+            SpritePixel.Pixel = LowBitOfPixel | (HighBitOfPixel << 1);
+            if (SpritePixel.Pixel != 0 && This->SpriteLineBuffer[x].Pixel == 0)
+            {
+                This->SpriteLineBuffer[x] = SpritePixel;
+            }
+        }
     }
 }
 
@@ -912,148 +1256,128 @@ Bool8 NESPPU_StepClock(NESPPU *This)
      * WARNING: the following code was known to cause cancer, stroke, prostate cancer and even death. 
      *          Continue with descretion. YOU HAVE BEEN WARNED.
      * In all seriousness, consult https://www.nesdev.org/w/images/default/4/4f/Ppu.svg before reading this 
+     * (or NESPPU_InitDotActions, which is that diagram in code)
      * */
 
 
-    Bool8 ShouldRenderBackground = NESPPU_ShouldRenderBackground(This);
-    Bool8 ShouldRenderForeground = NESPPU_ShouldRenderForeground(This);
+    Bool8 ShouldRenderBackground = NESPPU_ShouldRenderBackground(This, This->Clk);
+    Bool8 ShouldRenderForeground = NESPPU_ShouldRenderForeground(This, This->Clk);
     Bool8 ShouldRender = ShouldRenderBackground || ShouldRenderForeground;
 
     if (This->ClkSinceVBlank)
         This->ClkSinceVBlank++;
-    if (This->ClkSinceVBlank == 4*(2270 + 199)) /* magic */
+    if (This->ClkSinceVBlank == PPU_VBLANK_CLEAR_CLK)
         This->Status &= ~PPUSTATUS_VBLANK;
 
-    /* putting these magic numbers in variable name makes this harder to read */
-    /* visible scanlines (-1 is pre-render) */
-    if (IN_RANGE(-1, This->Scanline, 239))
+    u32 Actions = sPPUDotActions[sPPUScanlineClass[This->Scanline + 1]][This->Clk];
+
+
+    /* ================= pre-render ================= */
+    if (Actions & PPU_ACTION_CLEAR_STATUS)
     {
-        /* prerender scanline */
-        if (This->Scanline == -1)
-        {
-            if (This->Clk == 1)
-            {
-                This->Status &= ~(
-                    PPUSTATUS_SPR0_HIT 
-                    //| PPUSTATUS_VBLANK
-                    | PPUSTATUS_SPR_OVERFLOW
-                );
-
-                /* clear sprite shifter to prevent garbage sprite data from being rendered */
-                Memset(This->SprPatternHiShifter, 0, sizeof This->SprPatternHiShifter);
-                Memset(This->SprPatternLoShifter, 0, sizeof This->SprPatternLoShifter);
-            }
-            /* constantly reload y components */
-            else if (ShouldRenderBackground && IN_RANGE(280, This->Clk, 304))
-            {
-                u16 YComponentMask = COARSE_Y_MASK | FINE_Y_MASK | (1 << 11); /* nametable y */
-                MASKED_LOAD(This->Loopy.v, This->Loopy.t, YComponentMask);
-            }
-        }
+        This->Status &= ~(
+            PPUSTATUS_SPR0_HIT 
+            //| PPUSTATUS_VBLANK
+            | PPUSTATUS_SPR_OVERFLOW
+        );
 
-        /* ================= background ================= */
-        if (This->Clk == 0)
-        {
-            /* do nothing */
-        }
-        else if (IN_RANGE(2, This->Clk, 256) || IN_RANGE(321, This->Clk, 337)) /* fetching data cycles */
-        {
-            NESPPU_FetchBackgroundData(This);
+        /* clear sprite line buffer to prevent garbage sprite data from being rendered, 
+         * sprites are never drawn on the first scanline */
+        Memset(This->SpriteLineBuffer, 0, sizeof This->SpriteLineBuffer);
+        This->VisibleSpriteCount = 0;
+    }
+    else if ((Actions & PPU_ACTION_RELOAD_Y) && ShouldRenderBackground)
+    {
+        u16 YComponentMask = COARSE_Y_MASK | FINE_Y_MASK | (1 << 11); /* nametable y */
+        MASKED_LOAD(This->Loopy.v, This->Loopy.t, YComponentMask);
+    }
 
-            /* end of visible frame, update y components */
-            if (ShouldRender && This->Clk == 256)
-            {
-                if (GET_FINE_Y(This->Loopy.v) != 7)              /* no wrapping */
-                {
-                    This->Loopy.v += 0x1000;            /* increment fine y */
-                }
-                else                                    /* fine y overflows into coarse y */
-                {
-                    This->Loopy.v &= ~FINE_Y_MASK;      /* clear fine y */
-                    u16 CoarseY = GET_COARSE_Y(This->Loopy.v);
-                    if (CoarseY == 29)                  /* wrap and switch nametable */
-                    {
-                        CoarseY = 0;
-                        This->Loopy.v ^= 0x0800;        /* flip nametable y */
-                    }
-                    else if (CoarseY == 31) /* wrap */
-                        CoarseY = 0;
-                    else CoarseY++;
-
-                    MASKED_LOAD(This->Loopy.v, CoarseY << 5, COARSE_Y_MASK);
-                }
-            }
-            else if (This->Clk == 337)
-            {
-                u16 NametableAddr = NAMETABLE_OFFSET + (This->Loopy.v & 0x0FFF);
-                NESPPU_ReadInternalMemory(This, NametableAddr);
-            }
+
+    /* ================= background ================= */
+    if (Actions & PPU_ACTION_SHIFT_BG)
+    {
+        NESPPU_UpdateShifters(This);
+        NESPPU_FetchBackgroundData(This, Actions);
+    }
+    if ((Actions & PPU_ACTION_INCREMENT_Y) && ShouldRender)
+    {
+        if (GET_FINE_Y(This->Loopy.v) != 7)              /* no wrapping */
+        {
+            This->Loopy.v += 0x1000;            /* increment fine y */
         }
-        else /* horizontal blank: 257..320, 337..340 */
+        else                                    /* fine y overflows into coarse y */
         {
-            /* set this for clk in 257..320 */
-            if (IN_RANGE(257, This->Clk, 320))
+            This->Loopy.v &= ~FINE_Y_MASK;      /* clear fine y */
+            u16 CoarseY = GET_COARSE_Y(This->Loopy.v);
+            if (CoarseY == 29)                  /* wrap and switch nametable */
             {
-                This->OAMAddr = 0;
+                CoarseY = 0;
+                This->Loopy.v ^= 0x0800;        /* flip nametable y */
             }
+            else if (CoarseY == 31) /* wrap */
+                CoarseY = 0;
+            else CoarseY++;
 
-            /* horizontal blank entry: update x component and shifters */
-            if (ShouldRender && This->Clk == 257)
-            {
-                NESPPU_ReloadBackgroundShifters(This);
-                u16 NametableXAndCoarseXMask = COARSE_X_MASK | (1 << 10); /* nametable x */
-                MASKED_LOAD(This->Loopy.v, This->Loopy.t, NametableXAndCoarseXMask);
-            }
-            /* horizontal blank ends: dummy fetches */
-            else if (This->Clk == 339)
-            {
-                u16 NametableAddr = NAMETABLE_OFFSET + (This->Loopy.v & 0x0FFF);
-                NESPPU_ReadInternalMemory(This, NametableAddr);
-            }
+            MASKED_LOAD(This->Loopy.v, CoarseY << 5, COARSE_Y_MASK);
         }
+    }
+    if (Actions & PPU_ACTION_DUMMY_NAMETABLE_FETCH)
+    {
+        u16 NametableAddr = NAMETABLE_OFFSET + (This->Loopy.v & 0x0FFF);
+        NESPPU_ReadInternalMemory(This, NametableAddr);
+    }
+    if (Actions & PPU_ACTION_RESET_OAM_ADDR)
+    {
+        This->OAMAddr = 0;
+    }
+    /* horizontal blank entry: update x component and shifters */
+    if ((Actions & PPU_ACTION_RELOAD_X) && ShouldRender)
+    {
+        NESPPU_ReloadBackgroundShifters(This);
+        u16 NametableXAndCoarseXMask = COARSE_X_MASK | (1 << 10); /* nametable x */
+        MASKED_LOAD(This->Loopy.v, This->Loopy.t, NametableXAndCoarseXMask);
+    }
+
 
+    /* ================= foreground ================= */
+    /* SPRITE EVALUATION: evaluate sprite at the end of each visible frame */
+    if ((Actions & PPU_ACTION_EVALUATE_SPRITES) && ShouldRenderForeground)
+    {
+        /* clear sprites to 0xFF, y pos of FF means the sprites are never visible */
+        Memset(This->VisibleSprites, 0xFF, sizeof This->VisibleSprites);
+        This->VisibleSpriteCount = 0;
 
-        /* ================= foreground ================= */
-        if (ShouldRenderForeground)
+        This->Spr0IsVisible = false;
+        for (uint i = 0; i < STATIC_ARRAY_SIZE(This->OAM.Entries); i++)
         {
-            /* SPRITE EVALUATION: evaluate sprite at the end of each visible frame */
-            if (This->Scanline >= 0 && This->Clk == 257)
+            int ScanlineDiff = This->Scanline - This->OAM.Entries[i].y;
+            int SpriteHeight = This->Ctrl & PPUCTRL_SPR_SIZE16? 16 : 8;
+            if (IN_RANGE(0, ScanlineDiff, SpriteHeight - 1))
             {
-                /* clear sprites to 0xFF, y pos of FF means the sprites are never visible */
-                Memset(This->VisibleSprites, 0xFF, sizeof This->VisibleSprites);
-                This->VisibleSpriteCount = 0;
-
-                This->Spr0IsVisible = false;
-                for (uint i = 0; i < STATIC_ARRAY_SIZE(This->OAM.Entries); i++)
+                if (This->VisibleSpriteCount < 8)
                 {
-                    int ScanlineDiff = This->Scanline - This->OAM.Entries[i].y;
-                    int SpriteHeight = This->Ctrl & PPUCTRL_SPR_SIZE16? 16 : 8;
-                    if (IN_RANGE(0, ScanlineDiff, SpriteHeight - 1))
-                    {
-                        if (This->VisibleSpriteCount < 8)
-                        {
-                            if (i == 0) /* sprite 0 */
-                                This->Spr0IsVisible = true;
-                            This->VisibleSprites[This->VisibleSpriteCount] = This->OAM.Entries[i];
-                            This->VisibleSpriteCount++;
-                        }
-                        else
-                        {
-                            This->Status |= PPUSTATUS_SPR_OVERFLOW;
-                            break;
-                        }
-                    }
+                    if (i == 0) /* sprite 0 */
+                        This->Spr0IsVisible = true;
+                    This->VisibleSprites[This->VisibleSpriteCount] = This->OAM.Entries[i];
+                    This->VisibleSpriteCount++;
+                }
+                else
+                {
+                    This->Status |= PPUSTATUS_SPR_OVERFLOW;
+                    break;
                 }
-            }
-            /* find data from pattern memory to draw the sprites needed */
-            else if (This->Clk == 340)
-            {
-                NESPPU_LoadSpriteData(This);
             }
         }
     }
-    /* vblank starts */
-    else if (This->Scanline == 241 && This->Clk == 1)
+    /* find data from pattern memory to draw the sprites needed */
+    else if ((Actions & PPU_ACTION_LOAD_SPRITES) && ShouldRenderForeground)
+    {
+        NESPPU_LoadSpriteData(This);
+    }
+
+
+    /* ================= vblank ================= */
+    if (Actions & PPU_ACTION_SET_VBLANK)
     {
         if (!This->ShouldNotSetVBlankThisFrame)
         {
@@ -1076,30 +1400,343 @@ Bool8 NESPPU_StepClock(NESPPU *This)
                 This->NmiCallback(This->UserData);
             }
         }
-        
     }
 
 
+    if (Actions & PPU_ACTION_OUTPUT_PIXEL)
+    {
+        if (!This->SkipCurrentFrame)
+            NESPPU_RenderSinglePixel(This);
+        else if (!(This->Status & PPUSTATUS_SPR0_HIT))
+            NESPPU_DetectSpr0Hit(This);
+    }
+    if ((Actions & PPU_ACTION_END_OF_LINE) && !This->SkipCurrentFrame)
+    {
+        NESPPU_HashScanline(This);
 
-    NESPPU_RenderSinglePixel(This);
-
+        uint ScanlinesDone = This->Scanline + 1;
+        if (This->ScanlineCallback 
+        && (ScanlinesDone % This->ScanlinesPerBand == 0 || ScanlinesDone == NES_SCREEN_HEIGHT))
+        {
+            uint FirstScanline = (This->Scanline / This->ScanlinesPerBand) * This->ScanlinesPerBand;
+            This->ScanlineCallback(This->UserData, FirstScanline, ScanlinesDone - FirstScanline);
+        }
+    }
 
 
     Bool8 FrameCompleted = false;
     This->Clk++;
-    if (This->Clk == 341) /* PPU cycles per scanline */
+    if (This->Clk == PPU_DOTS_PER_SCANLINE)
     {
         This->Clk = 0;
         This->Scanline++;
-        if (This->Scanline == 261) /* last scanline */
+        if (This->Scanline == PPU_SCANLINES_PER_FRAME - 1) /* last scanline */
         {
             This->Scanline = -1; /* -1 to wrap around later */
-            This->FrameCompletionCallback(This->UserData);
+            if (!This->SkipCurrentFrame) /* nothing was hashed otherwise */
+            {
+                /* a frame that started before a reset is only partially hashed */
+                This->FrameHash = This->RunningFrameHash;
+                This->FrameHashIsValid = This->HashedScanlines == NES_SCREEN_HEIGHT;
+            }
+            /* a skipped frame still happened, there is just nothing new to show for it */
+            This->FrameCompletionCallback(This->UserData, This->SkipCurrentFrame);
+            This->RunningFrameHash = PPU_FRAME_HASH_SEED;
+            This->HashedScanlines = 0;
             FrameCompleted = true;
             This->CurrentFrameIsOdd = !This->CurrentFrameIsOdd;
+
+            This->SkipCurrentFrame = This->FramesSkipped < This->FrameSkip;
+            if (This->SkipCurrentFrame)
+                This->FramesSkipped++;
+            else This->FramesSkipped = 0;
         }
     }
     return FrameCompleted;
 }
 
+
+
+
+/* 
+ * Event prediction: 
+ * the functions below compute how many dots from now (0 meaning the very next NESPPU_StepClock call) 
+ * until something observable through PPUSTATUS happens, assuming nothing writes to the PPU 
+ * (registers, OAM, CHR, mapper) in between. 
+ * They are used to fast-forward a CPU that is polling PPUSTATUS in a loop. 
+ * Predictions are allowed to be early (the caller then just skips less), never late.
+ */
+
+#define PPU_EVENT_NEVER 0xFFFFFFFF
+#define PPU_DOTS_PER_FRAME (PPU_DOTS_PER_SCANLINE * PPU_SCANLINES_PER_FRAME)
+
+static uint NESPPU_DotsUntil(const NESPPU *This, int Scanline, uint Clk)
+{
+    int Now = (This->Scanline + 1) * PPU_DOTS_PER_SCANLINE + This->Clk;
+    int Then = (Scanline + 1) * PPU_DOTS_PER_SCANLINE + Clk;
+    if (Then < Now)
+        Then += PPU_DOTS_PER_FRAME;
+    return Then - Now;
+}
+
+static u8 NESPPU_PeekPatternMemory(NESPPU *This, u16 Address)
+{
+    /* no side effects on the mapper */
+    if (!This->CartridgeHandle || !*This->CartridgeHandle)
+        return 0;
+    return NESCartridge_DebugPPURead(*This->CartridgeHandle, Address);
+}
+
+static Bool8 NESPPU_PeekBackgroundPixelIsOpaque(NESPPU *This, u16 VerticalScroll, uint LeftmostTile, uint x)
+{
+    /* LeftmostTile: nametable x and coarse x (6 bits) of the tile at the left edge of the screen */
+    uint Column = This->Loopy.x + x;
+    uint Tile = (LeftmostTile + Column / 8) & 0x3F;
+    u16 NametableAddr = NAMETABLE_OFFSET 
+        | (VerticalScroll & ((1 << 11) | COARSE_Y_MASK))    /* nametable y, coarse y */
+        | ((Tile & 0x20) << 5)                              /* nametable x */
+        | (Tile & COARSE_X_MASK);
+    u8 TileIndex = *NESPPU_GetNametableByte(This, NametableAddr);
+
+    u16 PatternAddr = 
+        (This->Ctrl & PPUCTRL_BG_PATTERN_ADDR? 0x1000 : 0x0000)
+        | ((u16)TileIndex * TILE_SIZE) 
+        | GET_FINE_Y(VerticalScroll);
+    u8 PatternLo = NESPPU_PeekPatternMemory(This, PatternAddr);
+    u8 PatternHi = NESPPU_PeekPatternMemory(This, PatternAddr + 8);
+    u8 Bit = 7 - (Column % 8);
+    return ((PatternLo | PatternHi) >> Bit) & 0x1;
+}
+
+static u16 NESPPU_IncrementVerticalScroll(u16 VerticalScroll)
+{
+    if (GET_FINE_Y(VerticalScroll) != 7)
+        return VerticalScroll + 0x1000;
+
+    VerticalScroll &= ~FINE_Y_MASK;
+    u16 CoarseY = GET_COARSE_Y(VerticalScroll);
+    if (CoarseY == 29)
+    {
+        CoarseY = 0;
+        VerticalScroll ^= 0x0800;
+    }
+    else if (CoarseY == 31)
+        CoarseY = 0;
+    else CoarseY++;
+    MASKED_LOAD(VerticalScroll, CoarseY << 5, COARSE_Y_MASK);
+    return VerticalScroll;
+}
+
+/* dots until PPUSTATUS_VBLANK is set (and NMI is requested if enabled) */
+uint NESPPU_PredictVBlank(const NESPPU *This)
+{
+    return NESPPU_DotsUntil(This, 241, 1);
+}
+
+/* dots until the frame completion callback is called */
+uint NESPPU_PredictFrameCompletion(const NESPPU *This)
+{
+    return NESPPU_DotsUntil(This, PPU_SCANLINES_PER_FRAME - 2, PPU_DOTS_PER_SCANLINE - 1);
+}
+
+/* dots until the scanline callback is called, PPU_EVENT_NEVER if there isn't one */
+uint NESPPU_PredictScanlineCallback(const NESPPU *This)
+{
+    if (!This->ScanlineCallback)
+        return PPU_EVENT_NEVER;
+
+    int Scanline = This->Scanline;
+    if (Scanline < 0)
+        Scanline = 0;
+    else if (This->Clk > NES_SCREEN_WIDTH)
+        Scanline++;
+    if (Scanline >= NES_SCREEN_HEIGHT) /* the first band of the next frame */
+        Scanline = 0;
+
+    /* the last scanline of the band that Scanline is in */
+    int LastScanline = (Scanline / This->ScanlinesPerBand + 1) * This->ScanlinesPerBand - 1;
+    if (LastScanline >= NES_SCREEN_HEIGHT)
+        LastScanline = NES_SCREEN_HEIGHT - 1;
+    return NESPPU_DotsUntil(This, LastScanline, NES_SCREEN_WIDTH);
+}
+
+/* dots until PPUSTATUS_SPR0_HIT is set in the current frame, 
+ * PPU_EVENT_NEVER if it won't be set before the next vblank */
+uint NESPPU_PredictSpr0Hit(NESPPU *This)
+{
+    if ((This->Status & PPUSTATUS_SPR0_HIT) 
+    || !(This->Mask & PPUMASK_SHOW_BG) 
+    || !(This->Mask & PPUMASK_SHOW_SPR)
+    || !IN_RANGE(-1, This->Scanline, NES_SCREEN_HEIGHT - 1))
+    {
+        return PPU_EVENT_NEVER;
+    }
+
+    /* the current line's sprites are already in the line buffer, 
+     * don't bother with the background, just report the first possible hit */
+    int Scanline = This->Scanline;
+    if (Scanline >= 0 && This->Clk <= NES_SCREEN_WIDTH)
+    {
+        uint FirstPixel = This->Clk? This->Clk - 1 : 0;
+        for (uint x = FirstPixel; x < NES_SCREEN_WIDTH; x++)
+        {
+            if (This->SpriteLineBuffer[x].IsSpr0 && NESPPU_CanHitSpr0At(This, x + 1))
+                return NESPPU_DotsUntil(This, Scanline, x + 1);
+        }
+    }
+
+    /* sprites are only evaluated and loaded when this is true at dot 257 and 340, 
+     * otherwise the line buffer (and any sprite 0 in it) stays for the rest of the frame */
+    if (!NESPPU_ShouldRenderForeground(This, 257))
+    {
+        for (uint x = 0; x < NES_SCREEN_WIDTH; x++)
+        {
+            if (This->SpriteLineBuffer[x].IsSpr0 && NESPPU_CanHitSpr0At(This, x + 1))
+                return Scanline + 1 < NES_SCREEN_HEIGHT
+                    ? NESPPU_DotsUntil(This, Scanline + 1, x + 1)
+                    : PPU_EVENT_NEVER;
+        }
+        return PPU_EVENT_NEVER;
+    }
+
+
+    /* walk the scroll registers forward to the start of the next scanline, 
+     * rendering is enabled so every step below does happen */
+    u16 VerticalScroll = This->Loopy.v & (FINE_Y_MASK | (1 << 11) | COARSE_Y_MASK);
+    uint HorizontalScroll = ((This->Loopy.v >> 5) & 0x20) | GET_COARSE_X(This->Loopy.v);
+    uint LeftmostTile;
+    if (This->Clk <= 256)
+        VerticalScroll = NESPPU_IncrementVerticalScroll(VerticalScroll);
+    if (Scanline == -1 && This->Clk <= 304 && NESPPU_ShouldRenderBackground(This, 280))
+        VerticalScroll = This->Loopy.t & (FINE_Y_MASK | (1 << 11) | COARSE_Y_MASK);
+    if (This->Clk <= 257)
+    {
+        LeftmostTile = ((This->Loopy.t >> 5) & 0x20) | GET_COARSE_X(This->Loopy.t);
+    }
+    else
+    {
+        /* reloaded at 257, prefetches of the next 2 tiles increment it at 328 and 336 */
+        uint Increments = (This->Clk > 328) + (This->Clk > 336);
+        LeftmostTile = (HorizontalScroll - Increments) & 0x3F;
+    }
+
+    const NESPPU_ObjectAttribute *Spr0;
+    int SpriteHeight = This->Ctrl & PPUCTRL_SPR_SIZE16? 16 : 8;
+    for (Scanline = Scanline + 1; Scanline < NES_SCREEN_HEIGHT; Scanline++)
+    {
+        /* sprite 0 is evaluated on the scanline before */
+        int EvaluatedAt = Scanline - 1;
+        Bool8 Spr0IsVisible = EvaluatedAt >= 0 
+            && IN_RANGE(0, EvaluatedAt - This->OAM.Entries[0].y, SpriteHeight - 1);
+        if (EvaluatedAt == This->Scanline && This->Clk > 257) /* already evaluated */
+        {
+            Spr0IsVisible = This->Spr0IsVisible && This->VisibleSpriteCount > 0;
+            Spr0 = &This->VisibleSprites[0];
+        }
+        else 
+        {
+            Spr0 = &This->OAM.Entries[0];
+        }
+
+        if (Spr0IsVisible)
+        {
+            u16 PatternAddr = NESPPU_GetSpritePatternAddr(This, Spr0, EvaluatedAt);
+            u8 SprPattern = 
+                NESPPU_PeekPatternMemory(This, PatternAddr) 
+                | NESPPU_PeekPatternMemory(This, PatternAddr + 8);
+            if (Spr0->Attribute & PPU_OA_FLIP_HORIZONTAL)
+                SprPattern = FlipByte(SprPattern);
+
+            for (uint x = Spr0->x; 
+                x < (uint)Spr0->x + 8 && x < NES_SCREEN_WIDTH; 
+                x++, SprPattern <<= 1)
+            {
+                if ((SprPattern & 0x80)
+                && NESPPU_CanHitSpr0At(This, x + 1)
+                && NESPPU_PeekBackgroundPixelIsOpaque(This, VerticalScroll, LeftmostTile, x))
+                {
+                    return NESPPU_DotsUntil(This, Scanline, x + 1);
+                }
+            }
+        }
+        VerticalScroll = NESPPU_IncrementVerticalScroll(VerticalScroll);
+        LeftmostTile = ((This->Loopy.t >> 5) & 0x20) | GET_COARSE_X(This->Loopy.t);
+    }
+    return PPU_EVENT_NEVER;
+}
+
+/* dots until PPUSTATUS_SPR_OVERFLOW is set in the current frame, 
+ * PPU_EVENT_NEVER if it won't be set before the next vblank */
+static uint NESPPU_PredictSpriteOverflow(const NESPPU *This)
+{
+    if ((This->Status & PPUSTATUS_SPR_OVERFLOW)
+    || !NESPPU_ShouldRenderForeground(This, 257)
+    || !IN_RANGE(-1, This->Scanline, NES_SCREEN_HEIGHT - 1))
+    {
+        return PPU_EVENT_NEVER;
+    }
+
+    int SpriteHeight = This->Ctrl & PPUCTRL_SPR_SIZE16? 16 : 8;
+    int Scanline = This->Clk <= 257? This->Scanline : This->Scanline + 1;
+    if (Scanline < 0)
+        Scanline = 0;
+    for (; Scanline < NES_SCREEN_HEIGHT; Scanline++)
+    {
+        uint SpriteCount = 0;
+        for (uint i = 0; i < STATIC_ARRAY_SIZE(This->OAM.Entries); i++)
+        {
+            SpriteCount += IN_RANGE(0, Scanline - This->OAM.Entries[i].y, SpriteHeight - 1);
+        }
+        if (SpriteCount > 8)
+            return NESPPU_DotsUntil(This, Scanline, 257);
+    }
+    return PPU_EVENT_NEVER;
+}
+
+/* dots until the earliest of anything that changes what a PPUSTATUS read returns, 
+ * or until reading PPUSTATUS starts having side effects other than clearing vblank */
+uint NESPPU_PredictNextStatusEvent(NESPPU *This)
+{
+    /* reading status right before vblank suppresses it (see NESPPU_ExternalRead), 
+     * that depends on where the PPU is after a step, so one dot earlier than the rest */
+    uint Dots = NESPPU_DotsUntil(This, 240, 0);
+    if (Dots)
+        Dots--;
+    uint VBlank = NESPPU_PredictVBlank(This);
+    uint Spr0Hit = NESPPU_PredictSpr0Hit(This);
+    uint Overflow = NESPPU_PredictSpriteOverflow(This);
+    if (VBlank < Dots)
+        Dots = VBlank;
+    if (Spr0Hit < Dots)
+        Dots = Spr0Hit;
+    if (Overflow < Dots)
+        Dots = Overflow;
+    /* the above only look at the current frame, 
+     * during vblank stop at the pre-render line and predict again from there */
+    if (!IN_RANGE(-1, This->Scanline, NES_SCREEN_HEIGHT - 1))
+    {
+        uint PreRender = NESPPU_DotsUntil(This, -1, 0);
+        if (PreRender < Dots)
+            Dots = PreRender;
+    }
+
+    /* pre-render clears spr0 hit and overflow */
+    if (This->Status & (PPUSTATUS_SPR0_HIT | PPUSTATUS_SPR_OVERFLOW))
+    {
+        uint PreRender = NESPPU_DotsUntil(This, -1, 1);
+        if (PreRender < Dots)
+            Dots = PreRender;
+    }
+    /* vblank flag is cleared some time after being set */
+    if ((This->Status & PPUSTATUS_VBLANK) && This->ClkSinceVBlank)
+    {
+        uint VBlankClear = This->ClkSinceVBlank < PPU_VBLANK_CLEAR_CLK
+            ? PPU_VBLANK_CLEAR_CLK - This->ClkSinceVBlank - 1
+            : PPU_EVENT_NEVER;
+        if (VBlankClear < Dots)
+            Dots = VBlankClear;
+    }
+    return Dots;
+}
+
 #endif /* NES_PPU_C */
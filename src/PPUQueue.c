@@ -0,0 +1,92 @@
+#ifndef NES_PPU_QUEUE_C
+#define NES_PPU_QUEUE_C
+
+/*
+ * single producer single consumer queue of PPU register writes, lock free, same scheme as NESAudioRing:
+ * the emulator thread pushes writes stamped with the clk they happened at,
+ * the PPU thread catches the PPU up to each one and applies it (see Nes_OnPPULoop)
+ */
+
+#include "Common.h"
+#include "Utils.h"
+#include "Nes.h"
+
+
+#define PPU_QUEUE_SIZE 1024 /* power of 2 */
+/* not a register write, the PPU only has to be caught up to Clk */
+#define PPU_QUEUE_SYNC 0xFFFF
+
+typedef struct NESPPUQueueEntry
+{
+    u64 Clk;
+    u16 Address;
+    u8 Byte;
+} NESPPUQueueEntry;
+
+typedef struct NESPPUQueue
+{
+    NESPPUQueueEntry Entries[PPU_QUEUE_SIZE];
+    /* both only ever go up (and wrap around),
+     * ReadIndex only goes up once an entry is done with, so an empty queue means the PPU thread is idle */
+    volatile u32 WriteIndex; /* only written by the producer */
+    volatile u32 ReadIndex;  /* only written by the consumer */
+} NESPPUQueue;
+
+
+/* can be called from either side */
+Bool8 NESPPUQueue_IsEmpty(const NESPPUQueue *This)
+{
+    return This->WriteIndex == This->ReadIndex;
+}
+
+/* producer side, returns false if the queue is full and nothing was pushed */
+Bool8 NESPPUQueue_Push(NESPPUQueue *This, u64 Clk, u16 Address, u8 Byte)
+{
+    u32 Write = This->WriteIndex;
+    if (Write - This->ReadIndex == PPU_QUEUE_SIZE)
+        return false;
+    /* full barrier (storing the same value back),
+     * so that the entry is only written after the consumer is seen to be done with it */
+    Platform_AtomicExchange(&This->WriteIndex, Write);
+
+    NESPPUQueueEntry *Entry = &This->Entries[Write & (PPU_QUEUE_SIZE - 1)];
+    Entry->Clk = Clk;
+    Entry->Address = Address;
+    Entry->Byte = Byte;
+
+    /* publish it */
+    Platform_AtomicExchange(&This->WriteIndex, Write + 1);
+    return true;
+}
+
+/* producer side, spins until the consumer is done with everything that was pushed,
+ * whatever it did to apply them is visible afterward */
+void NESPPUQueue_WaitUntilEmpty(NESPPUQueue *This)
+{
+    while (!NESPPUQueue_IsEmpty(This))
+    {
+    }
+    /* full barrier, nothing the consumer wrote gets read before ReadIndex was */
+    Platform_AtomicExchange(&This->WriteIndex, This->WriteIndex);
+}
+
+/* consumer side, returns NULL if there is nothing in the queue,
+ * the entry stays in the queue until NESPPUQueue_Pop */
+const NESPPUQueueEntry *NESPPUQueue_Peek(NESPPUQueue *This)
+{
+    u32 Read = This->ReadIndex;
+    if (This->WriteIndex == Read)
+        return NULL;
+    /* full barrier, so that the entry is only read after WriteIndex was */
+    Platform_AtomicExchange(&This->ReadIndex, Read);
+    return &This->Entries[Read & (PPU_QUEUE_SIZE - 1)];
+}
+
+/* consumer side, hands the entry returned by NESPPUQueue_Peek back to the producer,
+ * everything done to apply it is visible to the producer afterward */
+void NESPPUQueue_Pop(NESPPUQueue *This)
+{
+    Platform_AtomicExchange(&This->ReadIndex, This->ReadIndex + 1);
+}
+
+#endif /* NES_PPU_QUEUE_C */
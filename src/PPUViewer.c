@@ -0,0 +1,198 @@
+#ifndef NES_PPUVIEWER_C
+#define NES_PPUVIEWER_C
+
+/*
+ * nametable, attribute and sprite viewers for the debug view,
+ * drawn from a NESPPU_Snapshot so they never have to touch the PPU the emulator is running
+ */
+
+#include "Common.h"
+#include "Utils.h"
+#include "Nes.h"
+#include "PPU.c"
+#include "Scaler.c"
+
+
+#define PPUVIEWER_TILE_COUNT 512 /* both pattern tables */
+
+/* every tile in both pattern tables decoded into 2 bit pixels,
+ * so the viewers don't have to decode them for every pixel */
+typedef struct NESPPUViewer_TileCache
+{
+    u8 Pixels[PPUVIEWER_TILE_COUNT][8][8];
+} NESPPUViewer_TileCache;
+
+/* nametables being drawn, see NESPPUViewer_DrawNametables */
+typedef struct NESPPUViewer_NametablesJob
+{
+    Nes_DebugNametables *View;
+    const NESPPU_Snapshot *Snapshot;
+    const NESPPUViewer_TileCache *Tiles;
+} NESPPUViewer_NametablesJob;
+
+/* just to tell the 4 palettes apart */
+static const u32 sPPUViewerAttributeColors[4] = {
+    0x303030, 0xC03030, 0x30C030, 0x3030C0,
+};
+
+
+/* Chr: both pattern tables, as in NESPPU_Snapshot */
+void NESPPUViewer_DecodeTiles(NESPPUViewer_TileCache *Cache, const u8 *Chr)
+{
+    for (uint Tile = 0; Tile < PPUVIEWER_TILE_COUNT; Tile++)
+    {
+        for (uint y = 0; y < 8; y++)
+        {
+            u8 Lo = Chr[Tile*TILE_SIZE + y];
+            u8 Hi = Chr[Tile*TILE_SIZE + y + TILE_SIZE/2];
+            for (uint x = 0; x < 8; x++)
+            {
+                Cache->Pixels[Tile][y][x] = ((Lo >> (7 - x)) & 1) | (((Hi >> (7 - x)) & 1) << 1);
+            }
+        }
+    }
+}
+
+static u32 NESPPUViewer_GetColor(const NESPPU_Snapshot *Snapshot, u8 Pixel, u8 Palette)
+{
+    /* transparent pixels of every palette show the backdrop color */
+    u8 PaletteIndex = Pixel? ((Palette & 0x7) << 2) | (Pixel & 0x3) : 0;
+    return sPPURGBPalette[Snapshot->PaletteColorIndex[PaletteIndex] % STATIC_ARRAY_SIZE(sPPURGBPalette)];
+}
+
+static u8 NESPPUViewer_GetAttribute(const NESPPU_Snapshot *Snapshot, uint Nametable, uint TileX, uint TileY)
+{
+    u8 AttributeByte = Snapshot->Nametables[Nametable][0x3C0 + (TileY / 4)*8 + TileX / 4];
+    uint Shift = ((TileY & 2) << 1) | (TileX & 2);
+    return (AttributeByte >> Shift) & 0x3;
+}
+
+
+/* rows of tiles across the whole view (2 nametables side by side), NES_NAMETABLE_VIEW_HEIGHT/8 of them in total */
+static void NESPPUViewer_DrawNametableBand(void *Job, uint FirstTileRow, uint TileRowCount)
+{
+    const NESPPUViewer_NametablesJob *This = Job;
+    const NESPPU_Snapshot *Snapshot = This->Snapshot;
+    uint PatternTable = (Snapshot->Ctrl & PPUCTRL_BG_PATTERN_ADDR)? 256 : 0;
+    for (uint TileRow = FirstTileRow; TileRow < FirstTileRow + TileRowCount; TileRow++)
+    {
+        uint TileY = TileRow % (NES_SCREEN_HEIGHT/8);
+        uint BaseY = TileRow / (NES_SCREEN_HEIGHT/8) * NES_SCREEN_HEIGHT;
+        for (uint Half = 0; Half < 2; Half++)
+        {
+            uint Nametable = (BaseY? 2 : 0) + Half;
+            uint BaseX = Half * NES_SCREEN_WIDTH;
+            for (uint TileX = 0; TileX < NES_SCREEN_WIDTH/8; TileX++)
+            {
+                u8 ID = Snapshot->Nametables[Nametable][TileY*32 + TileX];
+                u8 Palette = NESPPUViewer_GetAttribute(Snapshot, Nametable, TileX, TileY);
+                const u8 (*Tile)[8] = This->Tiles->Pixels[PatternTable + ID];
+                for (uint y = 0; y < 8; y++)
+                {
+                    u32 *Row = &This->View->Pixels[BaseY + TileY*8 + y][BaseX + TileX*8];
+                    for (uint x = 0; x < 8; x++)
+                        Row[x] = NESPPUViewer_GetColor(Snapshot, Tile[y][x], Palette);
+                }
+            }
+        }
+    }
+}
+
+/* the 4 logical nametables side by side (0x2000 top left, 0x2400 top right, 0x2800 bottom left, 0x2C00 bottom right)
+ * with the visible screen outlined, the tiles are drawn in bands on Pool (see NESScaler_RunJob) */
+void NESPPUViewer_DrawNametables(NESScalerPool *Pool, Nes_DebugNametables *View,
+    const NESPPU_Snapshot *Snapshot, const NESPPUViewer_TileCache *Tiles)
+{
+    NESPPUViewer_NametablesJob Job = {
+        .View = View,
+        .Snapshot = Snapshot,
+        .Tiles = Tiles,
+    };
+    NESScaler_RunJob(Pool, NESPPUViewer_DrawNametableBand, &Job, NES_NAMETABLE_VIEW_HEIGHT/8);
+
+    /* the visible screen, wraps around both ways */
+    u16 t = Snapshot->Scroll;
+    uint ScrollX = ((t >> 10) & 1)*NES_SCREEN_WIDTH + GET_COARSE_X(t)*8 + Snapshot->FineX;
+    uint ScrollY = ((t >> 11) & 1)*NES_SCREEN_HEIGHT + GET_COARSE_Y(t)*8 + ((t >> 12) & 0x7);
+    ScrollY %= NES_NAMETABLE_VIEW_HEIGHT;
+    View->ScrollX = ScrollX;
+    View->ScrollY = ScrollY;
+    for (uint i = 0; i < NES_SCREEN_WIDTH; i++)
+    {
+        uint x = (ScrollX + i) % NES_NAMETABLE_VIEW_WIDTH;
+        View->Pixels[ScrollY][x] ^= 0xFFFFFF;
+        View->Pixels[(ScrollY + NES_SCREEN_HEIGHT - 1) % NES_NAMETABLE_VIEW_HEIGHT][x] ^= 0xFFFFFF;
+    }
+    for (uint i = 1; i < NES_SCREEN_HEIGHT - 1; i++)
+    {
+        uint y = (ScrollY + i) % NES_NAMETABLE_VIEW_HEIGHT;
+        View->Pixels[y][ScrollX] ^= 0xFFFFFF;
+        View->Pixels[y][(ScrollX + NES_SCREEN_WIDTH - 1) % NES_NAMETABLE_VIEW_WIDTH] ^= 0xFFFFFF;
+    }
+    View->Available = true;
+}
+
+/* which background palette each 16x16 area of the 4 nametables uses, same layout as NESPPUViewer_DrawNametables */
+void NESPPUViewer_DrawAttributes(Nes_DebugAttributes *View, const NESPPU_Snapshot *Snapshot)
+{
+    for (uint y = 0; y < NES_ATTRIBUTE_VIEW_HEIGHT; y++)
+    {
+        for (uint x = 0; x < NES_ATTRIBUTE_VIEW_WIDTH; x++)
+        {
+            uint Nametable = (x >= NES_ATTRIBUTE_VIEW_WIDTH/2) | ((y >= NES_ATTRIBUTE_VIEW_HEIGHT/2) << 1);
+            uint TileX = (x % (NES_ATTRIBUTE_VIEW_WIDTH/2)) * 2;
+            uint TileY = (y % (NES_ATTRIBUTE_VIEW_HEIGHT/2)) * 2;
+            u8 Palette = NESPPUViewer_GetAttribute(Snapshot, Nametable, TileX, TileY);
+            View->Palettes[y][x] = Palette;
+            View->Pixels[y][x] = sPPUViewerAttributeColors[Palette];
+        }
+    }
+    View->Available = true;
+}
+
+/* all 64 sprites in OAM order, 8 per row, each in an 8x16 cell */
+void NESPPUViewer_DrawSprites(Nes_DebugSprites *View,
+    const NESPPU_Snapshot *Snapshot, const NESPPUViewer_TileCache *Tiles)
+{
+    Bool8 Is8x16 = (Snapshot->Ctrl & PPUCTRL_SPR_SIZE16) != 0;
+    uint PatternTable = (Snapshot->Ctrl & PPUCTRL_SPR_PATTERN_ADDR)? 256 : 0;
+    View->Is8x16 = Is8x16;
+    for (uint i = 0; i < STATIC_ARRAY_SIZE(Snapshot->OAM); i++)
+    {
+        const NESPPU_ObjectAttribute *Sprite = &Snapshot->OAM[i];
+        View->Entries[i] = (Nes_DebugSprite) {
+            .X = Sprite->x,
+            .Y = Sprite->y,
+            .Tile = Sprite->ID,
+            .Attribute = Sprite->Attribute,
+        };
+
+        uint Height = Is8x16? 16 : 8;
+        uint CellX = (i % 8) * 8;
+        uint CellY = (i / 8) * 16;
+        u8 Palette = 4 + (Sprite->Attribute & PPU_OA_PALETTE);
+        for (uint y = 0; y < 16; y++)
+        {
+            u32 *Row = &View->Pixels[CellY + y][CellX];
+            if (y >= Height)
+            {
+                for (uint x = 0; x < 8; x++)
+                    Row[x] = 0;
+                continue;
+            }
+
+            uint SpriteY = (Sprite->Attribute & PPU_OA_FLIP_VERTICAL)? Height - 1 - y : y;
+            uint Tile = Is8x16
+                ? (Sprite->ID & 1)*256 + (Sprite->ID & 0xFE) + SpriteY / 8
+                : PatternTable + Sprite->ID;
+            for (uint x = 0; x < 8; x++)
+            {
+                uint SpriteX = (Sprite->Attribute & PPU_OA_FLIP_HORIZONTAL)? 7 - x : x;
+                Row[x] = NESPPUViewer_GetColor(Snapshot, Tiles->Pixels[Tile][SpriteY % 8][SpriteX], Palette);
+            }
+        }
+    }
+    View->Available = true;
+}
+
+#endif /* NES_PPUVIEWER_C */
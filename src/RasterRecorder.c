@@ -0,0 +1,169 @@
+#ifndef NES_RASTER_RECORDER_C
+#define NES_RASTER_RECORDER_C
+
+/*
+ * records every cpu access to the PPU registers along with where the PPU was at that moment,
+ * one frame at a time, to see where raster effects (scroll splits and such) happen
+ */
+
+#include "Common.h"
+#include "Utils.h"
+#include "Nes.h"
+#include "PPU.c"
+
+
+#define RASTER_LOG_NEW 0x80000000
+
+typedef struct NESRasterRecorder
+{
+    /* triple buffered like the screen, the back log belongs to the emulator, the front log to whoever queries it */
+    Nes_RasterLog Logs[3];
+    u32 BackIndex;
+    u32 FrontIndex;
+    volatile u32 LatestLog; /* index | RASTER_LOG_NEW */
+    u32 FrameNumber;
+} NESRasterRecorder;
+
+
+void NESRaster_Init(NESRasterRecorder *This)
+{
+    Memset(This, 0, sizeof *This);
+    This->BackIndex = 0;
+    This->LatestLog = 1;
+    This->FrontIndex = 2;
+    This->FrameNumber = 1;
+    This->Logs[0].FrameNumber = This->FrameNumber;
+}
+
+/* PPU must be caught up to Clk */
+void NESRaster_Record(NESRasterRecorder *This, const NESPPU *PPU, u64 Clk, u16 Register, u8 Value, Bool8 IsWrite)
+{
+    Nes_RasterLog *Log = &This->Logs[This->BackIndex];
+    Register &= 0x7;
+
+    /* anything that changes what the rest of the visible part of the scanline looks like */
+    if (IsWrite
+    && Register != PPU_OAM_ADDR && Register != PPU_OAM_DATA
+    && (PPU->Mask & (PPUMASK_SHOW_BG | PPUMASK_SHOW_SPR))
+    && IN_RANGE(0, PPU->Scanline, NES_SCREEN_HEIGHT - 1)
+    && IN_RANGE(1, PPU->Clk, NES_SCREEN_WIDTH))
+    {
+        Log->MidScanlineWrites++;
+    }
+
+    if (Log->EventCount == STATIC_ARRAY_SIZE(Log->Events))
+    {
+        Log->DroppedEvents++;
+        return;
+    }
+    Log->Events[Log->EventCount++] = (Nes_RasterEvent) {
+        .Clk = Clk,
+        .Scanline = PPU->Scanline,
+        .Dot = PPU->Clk,
+        .Register = Register,
+        .Value = Value,
+        .IsWrite = IsWrite,
+    };
+}
+
+static void NESRaster_StartBackLog(NESRasterRecorder *This)
+{
+    This->FrameNumber++;
+    Nes_RasterLog *Log = &This->Logs[This->BackIndex];
+    Log->FrameNumber = This->FrameNumber;
+    Log->EventCount = 0;
+    Log->DroppedEvents = 0;
+    Log->MidScanlineWrites = 0;
+}
+
+/* publishes the back log and starts a new one */
+void NESRaster_EndFrame(NESRasterRecorder *This)
+{
+    u32 Previous = Platform_AtomicExchange(&This->LatestLog, This->BackIndex | RASTER_LOG_NEW);
+    This->BackIndex = Previous & ~RASTER_LOG_NEW;
+    NESRaster_StartBackLog(This);
+}
+
+/* for when recording picks up again, the back log is missing whatever happened in between so it starts over.
+ * Only the back log is touched, whoever holds the front log can keep reading it */
+void NESRaster_Restart(NESRasterRecorder *This)
+{
+    NESRaster_StartBackLog(This);
+}
+
+/* the latest complete log, NULL if there isn't one yet */
+const Nes_RasterLog *NESRaster_GetLatestLog(NESRasterRecorder *This)
+{
+    if (This->LatestLog & RASTER_LOG_NEW)
+    {
+        u32 Latest = Platform_AtomicExchange(&This->LatestLog, This->FrontIndex);
+        This->FrontIndex = Latest & ~RASTER_LOG_NEW;
+    }
+
+    const Nes_RasterLog *Log = &This->Logs[This->FrontIndex];
+    if (Log->FrameNumber == 0)
+        return NULL;
+    return Log;
+}
+
+
+
+/* both of these truncate the output to fit in Buffer, which is always null terminated, 
+ * and return the length of the output */
+isize Nes_FormatRasterLogCSV(const Nes_RasterLog *Log, char *Buffer, isize BufferSize)
+{
+    DEBUG_ASSERT(Buffer && BufferSize > 0);
+    isize Length = AppendString(Buffer, BufferSize - 1, 0, "frame,clk,scanline,dot,register,value,access\n");
+    for (u32 i = 0; i < Log->EventCount; i++)
+    {
+        const Nes_RasterEvent *Event = &Log->Events[i];
+        char Line[128];
+        FormatString(Line, sizeof Line,
+            "{d},", (i64)Log->FrameNumber,
+            "{d},", (i64)Event->Clk,
+            "{d},", (i64)Event->Scanline,
+            "{d},", (i64)Event->Dot,
+            "${x4},", (u32)(0x2000 + Event->Register),
+            "${x2},", (u32)Event->Value,
+            "{s}\n", Event->IsWrite? "write" : "read",
+            NULL
+        );
+        Length = AppendString(Buffer, BufferSize - 1, Length, Line);
+    }
+    Buffer[Length] = '\0';
+    return Length;
+}
+
+isize Nes_FormatRasterTimeline(const Nes_RasterLog *Log, char *Buffer, isize BufferSize)
+{
+    DEBUG_ASSERT(Buffer && BufferSize > 0);
+    char Line[128];
+    FormatString(Line, sizeof Line,
+        "frame {d}: ", (i64)Log->FrameNumber,
+        "{d} mid-scanline writes", (i64)Log->MidScanlineWrites,
+        ", {d} events dropped\n", (i64)Log->DroppedEvents,
+        NULL
+    );
+    isize Length = AppendString(Buffer, BufferSize - 1, 0, Line);
+
+    /* only the writes that move the scroll around */
+    for (u32 i = 0; i < Log->EventCount; i++)
+    {
+        const Nes_RasterEvent *Event = &Log->Events[i];
+        if (!Event->IsWrite || (Event->Register != PPU_SCROLL && Event->Register != PPU_ADDR))
+            continue;
+
+        FormatString(Line, sizeof Line,
+            "line {d}", (i64)Event->Scanline,
+            " dot {d}: ", (i64)Event->Dot,
+            "${x4} = ", (u32)(0x2000 + Event->Register),
+            "${x2}\n", (u32)Event->Value,
+            NULL
+        );
+        Length = AppendString(Buffer, BufferSize - 1, Length, Line);
+    }
+    Buffer[Length] = '\0';
+    return Length;
+}
+
+#endif /* NES_RASTER_RECORDER_C */
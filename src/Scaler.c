@@ -0,0 +1,403 @@
+#ifndef NES_SCALER_C
+#define NES_SCALER_C
+
+/*
+ * pixel art scalers for finished frames (XRGB8888 only),
+ * see https://www.scale2x.it/algorithm for scale2x and scale3x,
+ * and Hyllian's xBR tutorial (https://forums.libretro.com/t/xbr-algorithm-tutorial/123) for xBR.
+ * A frame is scaled a band of rows at a time, by whichever threads get to it first (see NESScaler_RunPooled),
+ * the same pool also runs other per-row work on frames (see NESScaler_RunJob)
+ */
+
+#include "Common.h"
+#include "Utils.h"
+#include "Nes.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#  define NES_SCALER_SSE2
+#  include <emmintrin.h>
+#endif
+
+
+#define NES_SCALER_MAX_FACTOR 3
+/* how many pieces a frame is cut into for the scaler workers */
+#define NES_SCALER_BAND_COUNT 8
+
+/* does rows [FirstRow, FirstRow + RowCount) of a job, may be called from any thread calling NESScaler_WorkOnPool */
+typedef void (*NESScaler_BandCallback)(void *Job, uint FirstRow, uint RowCount);
+
+/* a frame being worked on, see NESScaler_RunJob */
+typedef struct NESScalerPool
+{
+    NESScaler_BandCallback Callback;
+    void *Job;
+    uint RowCount;
+
+    /* NESScaler_RunPooled's job */
+    Nes_Scaler Scaler;
+    u32 *Dst;
+    const u32 *Src;
+    uint Width, Height;
+
+    /* a band is claimed by adding 1 to NextBand, whoever gets a number below NES_SCALER_BAND_COUNT scales that band.
+     * A frame is only done once every band is, so a claim that lands below it is always on the current frame */
+    volatile u32 NextBand;
+    volatile u32 BandsDone;
+} NESScalerPool;
+
+
+NESScalerPool NESScaler_InitPool(void)
+{
+    /* nothing to claim until there is a frame */
+    NESScalerPool Pool = {
+        .NextBand = NES_SCALER_BAND_COUNT,
+        .BandsDone = NES_SCALER_BAND_COUNT,
+    };
+    return Pool;
+}
+
+uint NESScaler_GetFactor(Nes_Scaler Scaler)
+{
+    switch (Scaler)
+    {
+    case NES_SCALER_NONE: return 1;
+    case NES_SCALER_NEAREST2X:
+    case NES_SCALER_SCALE2X:
+    case NES_SCALER_XBR2X: return 2;
+    case NES_SCALER_NEAREST3X:
+    case NES_SCALER_SCALE3X: return 3;
+    case NES_SCALER_COUNT: break;
+    }
+    return 1;
+}
+
+
+/*
+ * the kernels below only write rows [FirstRow, FirstRow + RowCount) of Src scaled up,
+ * but can read any row of it
+ */
+
+static void NESScaler_Nearest(u32 *Dst, const u32 *Src, uint Width, uint FirstRow, uint RowCount, uint Factor)
+{
+    uint DstWidth = Width * Factor;
+    for (uint y = FirstRow; y < FirstRow + RowCount; y++)
+    {
+        const u32 *SrcRow = Src + y*Width;
+        u32 *DstRow = Dst + y*Factor*DstWidth;
+        uint x = 0;
+#ifdef NES_SCALER_SSE2
+        if (Factor == 2)
+        {
+            for (; x + 4 <= Width; x += 4)
+            {
+                __m128i E = _mm_loadu_si128((const __m128i *)(SrcRow + x));
+                _mm_storeu_si128((__m128i *)(DstRow + x*2), _mm_unpacklo_epi32(E, E));
+                _mm_storeu_si128((__m128i *)(DstRow + x*2 + 4), _mm_unpackhi_epi32(E, E));
+            }
+        }
+#endif
+        for (; x < Width; x++)
+        {
+            u32 Pixel = SrcRow[x];
+            for (uint i = 0; i < Factor; i++)
+                DstRow[x*Factor + i] = Pixel;
+        }
+
+        /* the rest of the rows are the same */
+        for (uint i = 1; i < Factor; i++)
+            Memcpy(DstRow + i*DstWidth, DstRow, DstWidth * sizeof(u32));
+    }
+}
+
+static void NESScaler_Scale2xPixel(u32 *DstRow0, u32 *DstRow1,
+    const u32 *Above, const u32 *Row, const u32 *Below, uint x, uint Width)
+{
+    uint Left = x == 0? x : x - 1;
+    uint Right = x == Width - 1? x : x + 1;
+    u32 B = Above[x], D = Row[Left], E = Row[x], F = Row[Right], H = Below[x];
+
+    if (B != H && D != F)
+    {
+        DstRow0[x*2 + 0] = D == B? D : E;
+        DstRow0[x*2 + 1] = B == F? F : E;
+        DstRow1[x*2 + 0] = D == H? D : E;
+        DstRow1[x*2 + 1] = H == F? F : E;
+    }
+    else
+    {
+        DstRow0[x*2 + 0] = E;
+        DstRow0[x*2 + 1] = E;
+        DstRow1[x*2 + 0] = E;
+        DstRow1[x*2 + 1] = E;
+    }
+}
+
+#ifdef NES_SCALER_SSE2
+/* Mask? IfSet : IfClear, for each pixel */
+static __m128i NESScaler_Select(__m128i Mask, __m128i IfSet, __m128i IfClear)
+{
+    return _mm_or_si128(_mm_and_si128(Mask, IfSet), _mm_andnot_si128(Mask, IfClear));
+}
+#endif
+
+static void NESScaler_Scale2x(u32 *Dst, const u32 *Src, uint Width, uint Height, uint FirstRow, uint RowCount)
+{
+    /*
+     *  A B C      E0 E1
+     *  D E F  ->  E2 E3
+     *  G H I
+     *  pixels outside of the frame are the same as the closest one inside
+     */
+    uint DstWidth = Width * 2;
+    for (uint y = FirstRow; y < FirstRow + RowCount; y++)
+    {
+        const u32 *Above = Src + (y == 0? y : y - 1)*Width;
+        const u32 *Row = Src + y*Width;
+        const u32 *Below = Src + (y == Height - 1? y : y + 1)*Width;
+        u32 *DstRow0 = Dst + (y*2)*DstWidth;
+        u32 *DstRow1 = DstRow0 + DstWidth;
+        uint x = 0;
+#ifdef NES_SCALER_SSE2
+        /* 4 pixels at a time, except for the ones at the edges, whose neighbors get clamped */
+        NESScaler_Scale2xPixel(DstRow0, DstRow1, Above, Row, Below, x, Width);
+        for (x = 1; x + 4 < Width; x += 4)
+        {
+            __m128i B = _mm_loadu_si128((const __m128i *)(Above + x));
+            __m128i D = _mm_loadu_si128((const __m128i *)(Row + x - 1));
+            __m128i E = _mm_loadu_si128((const __m128i *)(Row + x));
+            __m128i F = _mm_loadu_si128((const __m128i *)(Row + x + 1));
+            __m128i H = _mm_loadu_si128((const __m128i *)(Below + x));
+            __m128i NoEdge = _mm_or_si128(_mm_cmpeq_epi32(B, H), _mm_cmpeq_epi32(D, F));
+
+            __m128i E0 = NESScaler_Select(_mm_andnot_si128(NoEdge, _mm_cmpeq_epi32(D, B)), D, E);
+            __m128i E1 = NESScaler_Select(_mm_andnot_si128(NoEdge, _mm_cmpeq_epi32(B, F)), F, E);
+            __m128i E2 = NESScaler_Select(_mm_andnot_si128(NoEdge, _mm_cmpeq_epi32(D, H)), D, E);
+            __m128i E3 = NESScaler_Select(_mm_andnot_si128(NoEdge, _mm_cmpeq_epi32(H, F)), F, E);
+
+            _mm_storeu_si128((__m128i *)(DstRow0 + x*2), _mm_unpacklo_epi32(E0, E1));
+            _mm_storeu_si128((__m128i *)(DstRow0 + x*2 + 4), _mm_unpackhi_epi32(E0, E1));
+            _mm_storeu_si128((__m128i *)(DstRow1 + x*2), _mm_unpacklo_epi32(E2, E3));
+            _mm_storeu_si128((__m128i *)(DstRow1 + x*2 + 4), _mm_unpackhi_epi32(E2, E3));
+        }
+#endif
+        for (; x < Width; x++)
+        {
+            NESScaler_Scale2xPixel(DstRow0, DstRow1, Above, Row, Below, x, Width);
+        }
+    }
+}
+
+static void NESScaler_Scale3x(u32 *Dst, const u32 *Src, uint Width, uint Height, uint FirstRow, uint RowCount)
+{
+    /*
+     *  A B C      E0 E1 E2
+     *  D E F  ->  E3 E4 E5
+     *  G H I      E6 E7 E8
+     */
+    uint DstWidth = Width * 3;
+    for (uint y = FirstRow; y < FirstRow + RowCount; y++)
+    {
+        const u32 *Above = Src + (y == 0? y : y - 1)*Width;
+        const u32 *Row = Src + y*Width;
+        const u32 *Below = Src + (y == Height - 1? y : y + 1)*Width;
+        u32 *DstRow0 = Dst + (y*3)*DstWidth;
+        u32 *DstRow1 = DstRow0 + DstWidth;
+        u32 *DstRow2 = DstRow1 + DstWidth;
+        for (uint x = 0; x < Width; x++)
+        {
+            uint Left = x == 0? x : x - 1;
+            uint Right = x == Width - 1? x : x + 1;
+            u32 A = Above[Left], B = Above[x], C = Above[Right];
+            u32 D = Row[Left],   E = Row[x],   F = Row[Right];
+            u32 G = Below[Left], H = Below[x], I = Below[Right];
+
+            if (B != H && D != F)
+            {
+                DstRow0[x*3 + 0] = D == B? D : E;
+                DstRow0[x*3 + 1] = (D == B && E != C) || (B == F && E != A)? B : E;
+                DstRow0[x*3 + 2] = B == F? F : E;
+                DstRow1[x*3 + 0] = (D == B && E != G) || (D == H && E != A)? D : E;
+                DstRow1[x*3 + 1] = E;
+                DstRow1[x*3 + 2] = (B == F && E != I) || (H == F && E != C)? F : E;
+                DstRow2[x*3 + 0] = D == H? D : E;
+                DstRow2[x*3 + 1] = (D == H && E != I) || (H == F && E != G)? H : E;
+                DstRow2[x*3 + 2] = H == F? F : E;
+            }
+            else
+            {
+                for (uint i = 0; i < 3; i++)
+                {
+                    DstRow0[x*3 + i] = E;
+                    DstRow1[x*3 + i] = E;
+                    DstRow2[x*3 + i] = E;
+                }
+            }
+        }
+    }
+}
+
+/* how different 2 colors look, the way xBR measures it (weighted YUV) */
+static u32 NESScaler_ColorDistance(u32 A, u32 B)
+{
+    int R = (int)((A >> 16) & 0xFF) - (int)((B >> 16) & 0xFF);
+    int G = (int)((A >> 8) & 0xFF) - (int)((B >> 8) & 0xFF);
+    int Bl = (int)(A & 0xFF) - (int)(B & 0xFF);
+    int Y = 299*R + 587*G + 114*Bl;
+    int U = -169*R - 331*G + 500*Bl;
+    int V = 500*R - 419*G - 81*Bl;
+    if (Y < 0) Y = -Y;
+    if (U < 0) U = -U;
+    if (V < 0) V = -V;
+    return (u32)(48*Y + 7*U + 6*V);
+}
+
+/* the bottom right quarter of E (P[2][2]) scaled up 2x, P is E's 5x5 neighborhood (its corners aren't used):
+ *        A1 B1 C1
+ *     A0 A  B  C  C4
+ *     D0 D  E  F  F4
+ *     G0 G  H  I  I4
+ *        G5 H5 I5
+ * the other 3 quarters are the same thing on P rotated */
+static u32 NESScaler_XBRCorner(u32 P[5][5])
+{
+    u32 B = P[1][2], C = P[1][3];
+    u32 D = P[2][1], E = P[2][2], F = P[2][3], F4 = P[2][4];
+    u32 G = P[3][1], H = P[3][2], I = P[3][3], I4 = P[3][4];
+    u32 H5 = P[4][2], I5 = P[4][3];
+    if (E == F || E == H)
+        return E;
+
+    /* is there an edge running along H-F (cutting the corner off of E), or one running along E-I */
+    u32 AlongHF = NESScaler_ColorDistance(E, C) + NESScaler_ColorDistance(E, G)
+        + NESScaler_ColorDistance(I, F4) + NESScaler_ColorDistance(I, H5)
+        + 4*NESScaler_ColorDistance(H, F);
+    u32 AlongEI = NESScaler_ColorDistance(H, D) + NESScaler_ColorDistance(H, I5)
+        + NESScaler_ColorDistance(F, I4) + NESScaler_ColorDistance(F, B)
+        + 4*NESScaler_ColorDistance(E, I);
+    if (AlongHF >= AlongEI)
+        return E;
+
+    /* half way to whichever side of the edge is closer */
+    u32 Other = NESScaler_ColorDistance(E, F) <= NESScaler_ColorDistance(E, H)? F : H;
+    return (E & Other) + (((E ^ Other) & 0x00FEFEFE) >> 1);
+}
+
+/* Rotated[y][x] = P rotated 90 degrees clockwise */
+static void NESScaler_Rotate5x5(u32 Rotated[5][5], u32 P[5][5])
+{
+    for (uint y = 0; y < 5; y++)
+    {
+        for (uint x = 0; x < 5; x++)
+            Rotated[y][x] = P[4 - x][y];
+    }
+}
+
+static void NESScaler_XBR2x(u32 *Dst, const u32 *Src, uint Width, uint Height, uint FirstRow, uint RowCount)
+{
+    uint DstWidth = Width * 2;
+    for (uint y = FirstRow; y < FirstRow + RowCount; y++)
+    {
+        u32 *DstRow0 = Dst + (y*2)*DstWidth;
+        u32 *DstRow1 = DstRow0 + DstWidth;
+        for (uint x = 0; x < Width; x++)
+        {
+            /* pixels outside of the frame are the same as the closest one inside */
+            u32 P[5][5];
+            for (int j = 0; j < 5; j++)
+            {
+                int Row = (int)y + j - 2;
+                Row = Row < 0? 0 : Row >= (int)Height? (int)Height - 1 : Row;
+                for (int i = 0; i < 5; i++)
+                {
+                    int Column = (int)x + i - 2;
+                    Column = Column < 0? 0 : Column >= (int)Width? (int)Width - 1 : Column;
+                    P[j][i] = Src[Row*Width + Column];
+                }
+            }
+
+            /* rotating clockwise brings the top right, then top left, then bottom left quarter to the bottom right */
+            u32 Rotated[5][5];
+            DstRow1[x*2 + 1] = NESScaler_XBRCorner(P);
+            NESScaler_Rotate5x5(Rotated, P);
+            DstRow0[x*2 + 1] = NESScaler_XBRCorner(Rotated);
+            NESScaler_Rotate5x5(P, Rotated);
+            DstRow0[x*2 + 0] = NESScaler_XBRCorner(P);
+            NESScaler_Rotate5x5(Rotated, P);
+            DstRow1[x*2 + 0] = NESScaler_XBRCorner(Rotated);
+        }
+    }
+}
+
+static void NESScaler_RunBand(void *Job, uint FirstRow, uint RowCount)
+{
+    const NESScalerPool *This = Job;
+    u32 *Dst = This->Dst;
+    const u32 *Src = This->Src;
+    uint Width = This->Width, Height = This->Height;
+    switch (This->Scaler)
+    {
+    case NES_SCALER_NONE:       Memcpy(Dst + FirstRow*Width, Src + FirstRow*Width, RowCount * Width * sizeof(u32)); break;
+    case NES_SCALER_NEAREST2X:  NESScaler_Nearest(Dst, Src, Width, FirstRow, RowCount, 2); break;
+    case NES_SCALER_NEAREST3X:  NESScaler_Nearest(Dst, Src, Width, FirstRow, RowCount, 3); break;
+    case NES_SCALER_SCALE2X:    NESScaler_Scale2x(Dst, Src, Width, Height, FirstRow, RowCount); break;
+    case NES_SCALER_SCALE3X:    NESScaler_Scale3x(Dst, Src, Width, Height, FirstRow, RowCount); break;
+    case NES_SCALER_XBR2X:      NESScaler_XBR2x(Dst, Src, Width, Height, FirstRow, RowCount); break;
+    case NES_SCALER_COUNT: break;
+    }
+}
+
+/* works on bands of the pool's current job until there are none left to claim,
+ * returns true if it did any */
+Bool8 NESScaler_WorkOnPool(NESScalerPool *This)
+{
+    Bool8 DidAnything = false;
+    /* checked first so that idle workers don't keep counting up */
+    while (This->NextBand < NES_SCALER_BAND_COUNT)
+    {
+        u32 Band = Platform_AtomicAdd(&This->NextBand, 1);
+        if (Band >= NES_SCALER_BAND_COUNT)
+            break;
+
+        uint FirstRow = This->RowCount * Band / NES_SCALER_BAND_COUNT;
+        uint LastRow = This->RowCount * (Band + 1) / NES_SCALER_BAND_COUNT;
+        This->Callback(This->Job, FirstRow, LastRow - FirstRow);
+        Platform_AtomicAdd(&This->BandsDone, 1);
+        DidAnything = true;
+    }
+    return DidAnything;
+}
+
+/* runs Callback over RowCount rows of Job, a band at a time,
+ * the bands are shared with any thread calling NESScaler_WorkOnPool, 
+ * the calling thread does whatever they don't and returns once every row is done */
+void NESScaler_RunJob(NESScalerPool *This, NESScaler_BandCallback Callback, void *Job, uint RowCount)
+{
+    /* every band of the last job is done, nobody is looking at any of this */
+    This->Callback = Callback;
+    This->Job = Job;
+    This->RowCount = RowCount;
+    Platform_AtomicExchange(&This->BandsDone, 0);
+    /* publish it */
+    Platform_AtomicExchange(&This->NextBand, 0);
+    Platform_OnScalerJob();
+
+    NESScaler_WorkOnPool(This);
+    while (This->BandsDone < NES_SCALER_BAND_COUNT)
+    {
+    }
+    /* full barrier, the workers' output is only read after BandsDone was */
+    Platform_AtomicExchange(&This->BandsDone, NES_SCALER_BAND_COUNT);
+}
+
+/* Dst must be able to hold (Width * Height * NESScaler_GetFactor(Scaler)^2) pixels */
+void NESScaler_RunPooled(NESScalerPool *This, Nes_Scaler Scaler, u32 *Dst, const u32 *Src, uint Width, uint Height)
+{
+    This->Scaler = Scaler;
+    This->Dst = Dst;
+    This->Src = Src;
+    This->Width = Width;
+    This->Height = Height;
+    NESScaler_RunJob(This, NESScaler_RunBand, This, Height);
+}
+
+#endif /* NES_SCALER_C */
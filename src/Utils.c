@@ -93,6 +93,33 @@ isize AppendHex(char *Buffer, isize BufferSize, isize At, int MinDigitCount, u32
     return At;
 }
 
+isize AppendDecimal(char *Buffer, isize BufferSize, isize At, i64 Decimal)
+{
+    char Stack[20];
+    char *StackPtr = Stack;
+    u64 Magnitude = Decimal < 0? -(u64)Decimal : (u64)Decimal;
+
+    if (Decimal < 0 && At < BufferSize)
+        Buffer[At++] = '-';
+
+    /* generate the reversed version */
+    do {
+        *StackPtr++ = '0' + Magnitude % 10;
+        Magnitude /= 10;
+    } while (Magnitude);
+
+    /* spool the number into the buffer */
+    while (At < BufferSize && StackPtr > &Stack[0])
+    {
+        Buffer[At++] = *(--StackPtr);
+    }
+
+    /* null terminate */
+    if (BufferSize > 0 && At < BufferSize)
+        Buffer[At] = '\0';
+    return At;
+}
+
 isize FormatString(char *Buffer, isize BufferSize, ...)
 {
     va_list Args;
@@ -137,6 +164,11 @@ isize FormatStringArgs(char *Buffer, isize BufferSize, va_list Args)
             const char *Str = va_arg(Args, char *);
             Len = AppendString(Buffer, BufferSize, Len, Str);
         } break;
+        case 'd':
+        {
+            i64 Decimal = va_arg(Args, i64);
+            Len = AppendDecimal(Buffer, BufferSize, Len, Decimal);
+        } break;
         default:
         {
             DEBUG_ASSERT(false && "Unexpected format");
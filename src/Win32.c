@@ -24,6 +24,16 @@ typedef enum Win32_MenuOptions
     WIN32_FILE_MENU_OPEN = 0x100,
 } Win32_MenuOptions;
 
+/* what the bottom of the status window shows, cycled with 'V' */
+typedef enum Win32_PPUView 
+{
+    WIN32_PPUVIEW_PATTERN_TABLES = 0,
+    WIN32_PPUVIEW_NAMETABLES,
+    WIN32_PPUVIEW_ATTRIBUTES,
+    WIN32_PPUVIEW_SPRITES,
+    WIN32_PPUVIEW_COUNT,
+} Win32_PPUView;
+
 typedef struct Win32_Rect 
 {
     int X, Y, W, H;
@@ -39,7 +49,7 @@ typedef struct Win32_Audio
     WAVEHDR *Headers;
     u32 IndvBufferSize;
     i32 QueueSize;
-    i32 ReadyBufferCount;
+    HANDLE BufferDoneEvent; /* waveOut signals it every time it's done playing a buffer */
 
     volatile Bool8 ThreadShouldStop;
     volatile Bool8 ThreadTerminated;
@@ -70,12 +80,41 @@ static struct {
 
 static double sWin32_FontSize = -16.;
 static double sWin32_TimerFrequency;
-static Nes_DisplayableStatus sWin32_DisplayableStatus;
+static struct {
+    Nes_DebugRegisters Registers;
+    Nes_DebugPalette Palette;
+    Nes_DebugPatternTables PatternTables;
+    Nes_DebugDisassembly Disassembly;
+    Nes_DebugNametables Nametables;
+    Nes_DebugAttributes Attributes;
+    Nes_DebugSprites Sprites;
+    Nes_AudioStats Audio;
+    u32 RegistersVersion, PaletteVersion, PatternTablesVersion, DisassemblyVersion;
+    u32 NametablesVersion, AttributesVersion, SpritesVersion;
+    Win32_PPUView PPUView;
+} sWin32_Debug;
 static Platform_FrameBuffer sWin32_FrameBuffer;
 static Platform_ThreadContext sWin32_ThreadContext;
 
 static Win32_Audio sWin32_Audio = { 0 };
-static CRITICAL_SECTION sWin32_Audio_AccessingBufferCount;
+static struct {
+    volatile Bool8 ThreadShouldStop;
+    HANDLE ThreadHandle;
+} sWin32_Emulation;
+/* help Nes_PlatformQueryFrameBuffer scale and NTSC filter frames (and the nametable viewer draw), see Nes_OnScalerLoop */
+#define WIN32_MAX_SCALER_WORKERS 3
+static struct {
+    volatile Bool8 ThreadShouldStop;
+    HANDLE ThreadHandles[WIN32_MAX_SCALER_WORKERS];
+    LONG ThreadCount;
+    HANDLE WakeUp; /* semaphore, released once per worker for every frame */
+    Nes_Scaler Scaler; /* cycled with 'X' */
+} sWin32_Scaler;
+/* only with -ppu-thread, see Nes_SetPPUThread */
+static struct {
+    volatile Bool8 ThreadShouldStop;
+    HANDLE ThreadHandle;
+} sWin32_PPUThread;
 
 
 static void Win32_Fatal(const char *ErrorMessage)
@@ -356,40 +395,42 @@ static LRESULT CALLBACK Win32_StatusWndProc(HWND Window, UINT Msg, WPARAM WParam
 
 
             char Flags[] = "nv_bdizc";
-            if (sWin32_DisplayableStatus.N)
+            if (sWin32_Debug.Registers.N)
                 Flags[0] -= 32;
-            if (sWin32_DisplayableStatus.V)
+            if (sWin32_Debug.Registers.V)
                 Flags[1] -= 32;
-            if (sWin32_DisplayableStatus.B)
+            if (sWin32_Debug.Registers.B)
                 Flags[3] -= 32;
-            if (sWin32_DisplayableStatus.D)
+            if (sWin32_Debug.Registers.D)
                 Flags[4] -= 32;
-            if (sWin32_DisplayableStatus.I)
+            if (sWin32_Debug.Registers.I)
                 Flags[5] -= 32;
-            if (sWin32_DisplayableStatus.Z)
+            if (sWin32_Debug.Registers.Z)
                 Flags[6] -= 32;
-            if (sWin32_DisplayableStatus.C)
+            if (sWin32_Debug.Registers.C)
                 Flags[7] -= 32;
 
             char Tmp[4096];
             FormatString(
                 Tmp, sizeof Tmp,
-                "A:[{x2}]\n", (u32)sWin32_DisplayableStatus.A, 
-                "X:[{x2}]\n", (u32)sWin32_DisplayableStatus.X,
-                "Y:[{x2}]\n", (u32)sWin32_DisplayableStatus.Y, 
-                "PC:[{x4}]\n", (u32)sWin32_DisplayableStatus.PC, 
-                "SP:[{x4}]: {x4}\n", (u32)sWin32_DisplayableStatus.SP, (u32)sWin32_DisplayableStatus.StackValue,
-                "Flags: {s}", Flags,
+                "A:[{x2}]\n", (u32)sWin32_Debug.Registers.A, 
+                "X:[{x2}]\n", (u32)sWin32_Debug.Registers.X,
+                "Y:[{x2}]\n", (u32)sWin32_Debug.Registers.Y, 
+                "PC:[{x4}]\n", (u32)sWin32_Debug.Registers.PC, 
+                "SP:[{x4}]: {x4}\n", (u32)sWin32_Debug.Registers.SP, (u32)sWin32_Debug.Registers.StackValue,
+                "Flags: {s}\n", Flags,
+                "Audio: {d}ms, ", (i64)sWin32_Debug.Audio.LatencyMs,
+                "{d} underruns", (i64)(sWin32_Debug.Audio.Underruns + sWin32_Debug.Audio.DeviceUnderruns),
                 NULL
             );
             Win32_DrawTextWrap(DeviceContext, &Region, Tmp);
 
             Region.top = sWin32_Gui.MainWindowHeight / 5;
-            Region.top += Win32_DrawTextWrap(DeviceContext, &Region, sWin32_DisplayableStatus.DisasmBeforePC);
+            Region.top += Win32_DrawTextWrap(DeviceContext, &Region, sWin32_Debug.Disassembly.BeforePC);
                 Win32_InvertTextAndBackgroundColors(DeviceContext);
-            Region.top += Win32_DrawTextWrap(DeviceContext, &Region, sWin32_DisplayableStatus.DisasmAtPC);
+            Region.top += Win32_DrawTextWrap(DeviceContext, &Region, sWin32_Debug.Disassembly.AtPC);
                 Win32_InvertTextAndBackgroundColors(DeviceContext);
-            Win32_DrawTextWrap(DeviceContext, &Region, sWin32_DisplayableStatus.DisasmAfterPC);
+            Win32_DrawTextWrap(DeviceContext, &Region, sWin32_Debug.Disassembly.AfterPC);
 
 
             int PalettesToDisplay = NES_PALETTE_SIZE;
@@ -405,40 +446,86 @@ static LRESULT CALLBACK Win32_StatusWndProc(HWND Window, UINT Msg, WPARAM WParam
                     .bottom = y + h,
                     .right = x + w,
                 };
-                HBRUSH Color = CreateSolidBrush(sWin32_DisplayableStatus.Palette[i]);
+                HBRUSH Color = CreateSolidBrush(sWin32_Debug.Palette.Colors[i]);
                 FillRect(DeviceContext, &r, Color);
                 DeleteObject(Color);
             }
 
-            BITMAPINFO PatternTableBitmap = Win32_DefaultBitmapInfo(
-                NES_PATTERN_TABLE_WIDTH_PIX, 
-                NES_PATTERN_TABLE_HEIGHT_PIX
-            );
             int TableSize = sWin32_Gui.MainWindowWidth * 220. / 1350;
             int TableY = Height * .67;
             int TableX = Region.left + 10;
-            StretchDIBits(DeviceContext, 
-                TableX, TableY, 
-                TableSize, TableSize,
-                0, 0, 
-                NES_PATTERN_TABLE_WIDTH_PIX, 
-                NES_PATTERN_TABLE_HEIGHT_PIX, 
-                sWin32_DisplayableStatus.LeftPatternTable, 
-                &PatternTableBitmap, 
-                DIB_RGB_COLORS, 
-                SRCCOPY
-            );
-            StretchDIBits(DeviceContext, 
-                TableX + TableSize + 5, TableY, 
-                TableSize, TableSize,
-                0, 0, 
-                NES_PATTERN_TABLE_WIDTH_PIX, 
-                NES_PATTERN_TABLE_HEIGHT_PIX, 
-                sWin32_DisplayableStatus.RightPatternTable, 
-                &PatternTableBitmap, 
-                DIB_RGB_COLORS, 
-                SRCCOPY
-            );
+            switch (sWin32_Debug.PPUView)
+            {
+            case WIN32_PPUVIEW_PATTERN_TABLES:
+            {
+                BITMAPINFO PatternTableBitmap = Win32_DefaultBitmapInfo(
+                    NES_PATTERN_TABLE_WIDTH_PIX, 
+                    NES_PATTERN_TABLE_HEIGHT_PIX
+                );
+                StretchDIBits(DeviceContext, 
+                    TableX, TableY, 
+                    TableSize, TableSize,
+                    0, 0, 
+                    NES_PATTERN_TABLE_WIDTH_PIX, 
+                    NES_PATTERN_TABLE_HEIGHT_PIX, 
+                    sWin32_Debug.PatternTables.Left, 
+                    &PatternTableBitmap, 
+                    DIB_RGB_COLORS, 
+                    SRCCOPY
+                );
+                StretchDIBits(DeviceContext, 
+                    TableX + TableSize + 5, TableY, 
+                    TableSize, TableSize,
+                    0, 0, 
+                    NES_PATTERN_TABLE_WIDTH_PIX, 
+                    NES_PATTERN_TABLE_HEIGHT_PIX, 
+                    sWin32_Debug.PatternTables.Right, 
+                    &PatternTableBitmap, 
+                    DIB_RGB_COLORS, 
+                    SRCCOPY
+                );
+            } break;
+            case WIN32_PPUVIEW_NAMETABLES:
+            case WIN32_PPUVIEW_ATTRIBUTES:
+            {
+                /* same area as both pattern tables */
+                Bool8 ShowNametables = sWin32_Debug.PPUView == WIN32_PPUVIEW_NAMETABLES;
+                int ViewWidth = ShowNametables? NES_NAMETABLE_VIEW_WIDTH : NES_ATTRIBUTE_VIEW_WIDTH;
+                int ViewHeight = ShowNametables? NES_NAMETABLE_VIEW_HEIGHT : NES_ATTRIBUTE_VIEW_HEIGHT;
+                BITMAPINFO ViewBitmap = Win32_DefaultBitmapInfo(ViewWidth, ViewHeight);
+                StretchDIBits(DeviceContext, 
+                    TableX, TableY, 
+                    TableSize*2 + 5, (TableSize*2 + 5) * NES_SCREEN_HEIGHT / NES_SCREEN_WIDTH,
+                    0, 0, 
+                    ViewWidth, ViewHeight, 
+                    ShowNametables
+                        ? (const void *)sWin32_Debug.Nametables.Pixels
+                        : (const void *)sWin32_Debug.Attributes.Pixels, 
+                    &ViewBitmap, 
+                    DIB_RGB_COLORS, 
+                    SRCCOPY
+                );
+            } break;
+            case WIN32_PPUVIEW_SPRITES:
+            {
+                BITMAPINFO SpriteBitmap = Win32_DefaultBitmapInfo(
+                    NES_SPRITE_VIEW_WIDTH, 
+                    NES_SPRITE_VIEW_HEIGHT
+                );
+                StretchDIBits(DeviceContext, 
+                    TableX, TableY, 
+                    TableSize / 2, TableSize,
+                    0, 0, 
+                    NES_SPRITE_VIEW_WIDTH, 
+                    NES_SPRITE_VIEW_HEIGHT, 
+                    sWin32_Debug.Sprites.Pixels, 
+                    &SpriteBitmap, 
+                    DIB_RGB_COLORS, 
+                    SRCCOPY
+                );
+            } break;
+            case WIN32_PPUVIEW_COUNT: break;
+            }
 
             if (OldFont)
                 SelectObject(DeviceContext, OldFont);
@@ -571,6 +658,16 @@ static LRESULT CALLBACK Win32_MainWndProc(HWND Window, UINT Msg, WPARAM WParam,
         {
             Nes_OnEmulatorTogglePalette(sWin32_ThreadContext);
         } break;
+        case 'X':
+        {
+            sWin32_Scaler.Scaler = (sWin32_Scaler.Scaler + 1) % NES_SCALER_COUNT;
+            Nes_SetScaler(sWin32_ThreadContext, sWin32_Scaler.Scaler);
+        } break;
+        case 'V':
+        {
+            sWin32_Debug.PPUView = (sWin32_Debug.PPUView + 1) % WIN32_PPUVIEW_COUNT;
+            InvalidateRect(sWin32_Gui.StatusWindow, NULL, FALSE);
+        } break;
         case VK_SPACE:
         {
             Nes_OnEmulatorSingleStep(sWin32_ThreadContext);
@@ -610,115 +707,163 @@ static LRESULT CALLBACK Win32_MainWndProc(HWND Window, UINT Msg, WPARAM WParam,
 }
 
 
-static Bool8 Win32_PollInputs(void)
+static DWORD Win32_EmulationThread(void *UserData)
 {
-    MSG Msg;
-    while (PeekMessageA(&Msg, NULL, 0, 0, PM_REMOVE | PM_NOYIELD))
+    (void)UserData;
+    /* Sleep(1) sleeps for 15ms otherwise */
+    timeBeginPeriod(1);
+    double TimeOrigin = Platform_GetTimeMillisec();
+    while (!sWin32_Emulation.ThreadShouldStop)
     {
-        if (Msg.message == WM_QUIT)
-            return false;
-        TranslateMessage(&Msg);
-        DispatchMessageA(&Msg);
+        double Now = Platform_GetTimeMillisec();
+        Nes_OnLoop(sWin32_ThreadContext, Now - TimeOrigin);
+        Sleep(1);
     }
-    return true;
+    timeEndPeriod(1);
+    return 0;
 }
 
-static void Win32_UpdateWindowTimer(HWND Window, UINT DontCare, UINT_PTR DontCare2, DWORD DontCare3)
+static DWORD Win32_PPUThread(void *UserData)
 {
-    (void)Window, (void)DontCare, (void)DontCare2, (void)DontCare3;
-    sWin32_DisplayableStatus = Nes_PlatformQueryDisplayableStatus(sWin32_ThreadContext);
-    sWin32_FrameBuffer = Nes_PlatformQueryFrameBuffer(sWin32_ThreadContext);
-
-    InvalidateRect(sWin32_Gui.StatusWindow, NULL, FALSE);
-    InvalidateRect(sWin32_Gui.GameWindow, NULL, FALSE);
+    (void)UserData;
+    while (!sWin32_PPUThread.ThreadShouldStop)
+    {
+        /* the emulator thread waits on this one every time it syncs the PPU, so never sleep, only yield */
+        if (!Nes_OnPPULoop(sWin32_ThreadContext))
+            SwitchToThread();
+    }
+    return 0;
 }
 
+static DWORD Win32_ScalerThread(void *UserData)
+{
+    (void)UserData;
+    while (!sWin32_Scaler.ThreadShouldStop)
+    {
+        /* the timeout is only there to notice ThreadShouldStop */
+        if (WAIT_OBJECT_0 == WaitForSingleObject(sWin32_Scaler.WakeUp, 100))
+            Nes_OnScalerLoop(sWin32_ThreadContext);
+    }
+    return 0;
+}
 
-
-
-
-static void CALLBACK Win32_WaveOutCallback(
-    HWAVEOUT WaveOut, 
-    UINT Msg, 
-    DWORD_PTR UserData, 
-    DWORD_PTR Unused, 
-    DWORD_PTR Unused1)
+/* whether Arg is one of the space separated words of CmdLine */
+static Bool8 Win32_HasArgument(const char *CmdLine, const char *Arg)
 {
-    (void)WaveOut, (void)Msg, (void)UserData, (void)Unused, (void)Unused1;
-    if (Msg != WOM_DONE)
-        return;
+    isize ArgLength = Strlen(Arg);
+    for (const char *At = CmdLine; *At; At++)
+    {
+        Bool8 StartsWord = At == CmdLine || At[-1] == ' ';
+        if (StartsWord 
+        && Strlen(At) >= ArgLength 
+        && Memcmp(At, Arg, ArgLength)
+        && (At[ArgLength] == ' ' || At[ArgLength] == '\0'))
+        {
+            return true;
+        }
+    }
+    return false;
+}
 
+static void Win32_UpdateWindowTimer(HWND Window, UINT DontCare, UINT_PTR DontCare2, DWORD DontCare3)
+{
+    (void)Window, (void)DontCare, (void)DontCare2, (void)DontCare3;
+    sWin32_FrameBuffer = Nes_PlatformQueryFrameBuffer(sWin32_ThreadContext);
 
-    EnterCriticalSection(&sWin32_Audio_AccessingBufferCount);
+    /* only repaint the status window when something in it changed */
+    u32 OldVersions[] = {
+        sWin32_Debug.RegistersVersion, sWin32_Debug.PaletteVersion, 
+        sWin32_Debug.PatternTablesVersion, sWin32_Debug.DisassemblyVersion,
+        sWin32_Debug.NametablesVersion, sWin32_Debug.AttributesVersion, sWin32_Debug.SpritesVersion,
+    };
+    sWin32_Debug.RegistersVersion = 
+        Nes_PlatformQueryDebugRegisters(sWin32_ThreadContext, OldVersions[0], &sWin32_Debug.Registers);
+    sWin32_Debug.PaletteVersion = 
+        Nes_PlatformQueryDebugPalette(sWin32_ThreadContext, OldVersions[1], &sWin32_Debug.Palette);
+    sWin32_Debug.PatternTablesVersion = 
+        Nes_PlatformQueryDebugPatternTables(sWin32_ThreadContext, OldVersions[2], &sWin32_Debug.PatternTables);
+    sWin32_Debug.DisassemblyVersion = 
+        Nes_PlatformQueryDebugDisassembly(sWin32_ThreadContext, OldVersions[3], &sWin32_Debug.Disassembly);
+    sWin32_Debug.Audio = Nes_PlatformQueryAudioStats(sWin32_ThreadContext);
+    /* only the view that's shown, the rest are not worth drawing */
+    switch (sWin32_Debug.PPUView)
     {
-        sWin32_Audio.ReadyBufferCount++;
+    case WIN32_PPUVIEW_NAMETABLES: sWin32_Debug.NametablesVersion = 
+        Nes_PlatformQueryDebugNametables(sWin32_ThreadContext, OldVersions[4], &sWin32_Debug.Nametables); break;
+    case WIN32_PPUVIEW_ATTRIBUTES: sWin32_Debug.AttributesVersion = 
+        Nes_PlatformQueryDebugAttributes(sWin32_ThreadContext, OldVersions[5], &sWin32_Debug.Attributes); break;
+    case WIN32_PPUVIEW_SPRITES: sWin32_Debug.SpritesVersion = 
+        Nes_PlatformQueryDebugSprites(sWin32_ThreadContext, OldVersions[6], &sWin32_Debug.Sprites); break;
+    default: break;
     }
-    LeaveCriticalSection(&sWin32_Audio_AccessingBufferCount);
+    if (OldVersions[0] != sWin32_Debug.RegistersVersion 
+    || OldVersions[1] != sWin32_Debug.PaletteVersion
+    || OldVersions[2] != sWin32_Debug.PatternTablesVersion
+    || OldVersions[3] != sWin32_Debug.DisassemblyVersion
+    || OldVersions[4] != sWin32_Debug.NametablesVersion
+    || OldVersions[5] != sWin32_Debug.AttributesVersion
+    || OldVersions[6] != sWin32_Debug.SpritesVersion)
+    {
+        InvalidateRect(sWin32_Gui.StatusWindow, NULL, FALSE);
+    }
+    if (!sWin32_FrameBuffer.Unchanged)
+        InvalidateRect(sWin32_Gui.GameWindow, NULL, FALSE);
 }
 
+
+
+
+
 static DWORD Win32_AudioThread(void *UserData)
 {
     (void)UserData;
-    double t = 0;
-    double dt = 1.0 / sWin32_Audio.Config.SampleRate;
     u8 *Buffer = sWin32_Audio.Buffer;
     WAVEHDR *Headers = sWin32_Audio.Headers;
     isize IndvBufferSize = sWin32_Audio.IndvBufferSize;
     isize IndvBufferFrameCount = sWin32_Audio.IndvBufferSize / sizeof(int16_t) / sWin32_Audio.Config.ChannelCount;
     isize QueueIndex = 0;
+    Bool8 Started = false;
 
     while (!sWin32_Audio.ThreadShouldStop)
     {
+        /* every buffer came back before it got a new one, so there was a gap in the sound */
+        isize Playing = 0;
+        for (isize i = 0; i < sWin32_Audio.QueueSize; i++)
+        {
+            DWORD Flags = Headers[i].dwFlags;
+            Playing += (Flags & WHDR_PREPARED) && !(Flags & WHDR_DONE);
+        }
+        if (Started && 0 == Playing)
+            Nes_OnAudioDeviceStarved(sWin32_ThreadContext);
+        Started = true;
+
+        /* refill the buffers waveOut is done with (or never had), in the order they were queued */
         while (1)
         {
-            /* don't optimize and cannot take address 
-             * (ie no memory location, so it has to read into a register) */
-            register volatile i32 ReadyBufferCount = 0;
-            EnterCriticalSection(&sWin32_Audio_AccessingBufferCount);
-            {
-                ReadyBufferCount = sWin32_Audio.ReadyBufferCount;
-            }
-            LeaveCriticalSection(&sWin32_Audio_AccessingBufferCount);
-            if (ReadyBufferCount > 0)
+            WAVEHDR *Header = &Headers[QueueIndex];
+            if ((Header->dwFlags & WHDR_PREPARED) && !(Header->dwFlags & WHDR_DONE))
                 break;
-            Sleep(1);
-        }
-        do {
+
             i16 *SamplePtr = (i16*)&Buffer[
                 QueueIndex * IndvBufferSize
             ];
-            WAVEHDR *Header = &Headers[QueueIndex];
-            Header->lpData = (LPSTR)SamplePtr;
-            Header->dwBufferLength = IndvBufferSize;
-
-            /* fill the audio buffer */
-            for (u32 i = 0; i < IndvBufferFrameCount; i++)
-            {
-                i16 AudioSample = Nes_OnAudioSampleRequest(sWin32_ThreadContext, t);
-                t += dt;
-                for (u32 c = 0; c < sWin32_Audio.Config.ChannelCount; c++)
-                {
-                    *SamplePtr++ = AudioSample;
-                }
-            }
-
-            /* update buffer count */
-            EnterCriticalSection(&sWin32_Audio_AccessingBufferCount);
-            {
-                sWin32_Audio.ReadyBufferCount--;
-            }
-            LeaveCriticalSection(&sWin32_Audio_AccessingBufferCount);
+            Nes_RenderAudio(sWin32_ThreadContext, SamplePtr, IndvBufferFrameCount, sWin32_Audio.Config.ChannelCount);
 
-            /* create the audio buffer for waveout */
             if (Header->dwFlags & WHDR_PREPARED)
                 waveOutUnprepareHeader(sWin32_Audio.WaveOutHandle, Header, sizeof *Header);
+            Header->lpData = (LPSTR)SamplePtr;
+            Header->dwBufferLength = IndvBufferSize;
+            Header->dwFlags = 0;
             waveOutPrepareHeader(sWin32_Audio.WaveOutHandle, Header, sizeof *Header);
             waveOutWrite(sWin32_Audio.WaveOutHandle, Header, sizeof *Header);
 
             QueueIndex++;
             if (QueueIndex == sWin32_Audio.QueueSize)
                 QueueIndex = 0;
-        } while (sWin32_Audio.ReadyBufferCount > 0);
+        }
+
+        /* the timeout is only there to notice ThreadShouldStop */
+        WaitForSingleObject(sWin32_Audio.BufferDoneEvent, 100);
     }
     sWin32_Audio.ThreadTerminated = true;
     return 0;
@@ -735,12 +880,11 @@ static void Win32_DestroyAudio(void)
     }
 
 
-    DeleteCriticalSection(&sWin32_Audio_AccessingBufferCount);
-
-
     /* don't need to deallocate the buffer, windows does it faster than us */
     (void)sWin32_Audio.Buffer;
+    waveOutReset(sWin32_Audio.WaveOutHandle);
     waveOutClose(sWin32_Audio.WaveOutHandle);
+    CloseHandle(sWin32_Audio.BufferDoneEvent);
 }
 
 
@@ -762,14 +906,17 @@ static Bool8 Win32_InitializeAudio(Platform_AudioConfig Config, int BitsPerSampl
         .nAvgBytesPerSec = BytesPerSample * Config.SampleRate,
     };
 
-    /* create waveout */
+    /* create waveout, it wakes the audio thread up through the event instead of the thread polling */
+    sWin32_Audio.BufferDoneEvent = CreateEventA(NULL, FALSE, FALSE, NULL);
+    if (NULL == sWin32_Audio.BufferDoneEvent)
+        goto EventCreationFailed;
     MMRESULT ErrorCode = waveOutOpen(
         &sWin32_Audio.WaveOutHandle, 
         WAVE_MAPPER, 
         &sWin32_Audio.Format, 
-        (DWORD_PTR)Win32_WaveOutCallback, 
+        (DWORD_PTR)sWin32_Audio.BufferDoneEvent, 
         0, 
-        CALLBACK_FUNCTION
+        CALLBACK_EVENT
     );
     if (MMSYSERR_NOERROR != ErrorCode)
         goto WaveOutOpenFailed;
@@ -787,10 +934,6 @@ static Bool8 Win32_InitializeAudio(Platform_AudioConfig Config, int BitsPerSampl
     sWin32_Audio.Headers = (WAVEHDR*)(AudioBuffer + Config.BufferSizeBytes * Config.BufferQueueSize);
     sWin32_Audio.IndvBufferSize = Config.BufferSizeBytes;
     sWin32_Audio.QueueSize = Config.BufferQueueSize;
-    sWin32_Audio.ReadyBufferCount = Config.BufferQueueSize;
-
-
-    InitializeCriticalSection(&sWin32_Audio_AccessingBufferCount);
 
 
     /* create a thread handle */
@@ -811,6 +954,8 @@ FailedToCreateAudioThread:
 MemoryAllocationFailed:
     waveOutClose(sWin32_Audio.WaveOutHandle);
 WaveOutOpenFailed:
+    CloseHandle(sWin32_Audio.BufferDoneEvent);
+EventCreationFailed:
     return false;
 }
 
@@ -821,7 +966,7 @@ WaveOutOpenFailed:
 
 int WINAPI WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, PCHAR CmdLine, int CmdShow)
 {
-    (void)PrevInstance, (void)CmdLine, (void)CmdShow;
+    (void)PrevInstance, (void)CmdShow;
     {
         INITCOMMONCONTROLSEX CommCtrl = {
             .dwICC = ICC_UPDOWN_CLASS,
@@ -884,6 +1029,13 @@ int WINAPI WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, PCHAR CmdLine, in
     if (AudioConfig.EnableAudio)
     {
         HasAudio = Win32_InitializeAudio(AudioConfig, 16);
+        if (!HasAudio && AudioConfig.SampleRate != 44100)
+        {
+            /* the device might not take the emulator's rate, but everything takes 44.1kHz */
+            AudioConfig.SampleRate = 44100;
+            Nes_SetAudioSampleRate(sWin32_ThreadContext, AudioConfig.SampleRate);
+            HasAudio = Win32_InitializeAudio(AudioConfig, 16);
+        }
         if (!HasAudio)
         {
             Nes_OnAudioFailed(sWin32_ThreadContext);
@@ -892,13 +1044,71 @@ int WINAPI WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, PCHAR CmdLine, in
     }
 
 
+    /* the PPU can get a thread (and a core) of its own, it has to be running before the emulator thread */
+    if (Win32_HasArgument(CmdLine, "-ppu-thread"))
+    {
+        sWin32_PPUThread.ThreadShouldStop = false;
+        sWin32_PPUThread.ThreadHandle = CreateThread(NULL, 0, Win32_PPUThread, NULL, 0, NULL);
+        if (NULL == sWin32_PPUThread.ThreadHandle)
+        {
+            Win32_ErrorBox("Unable to create the PPU thread, the PPU runs on the emulator thread instead.");
+        }
+        else
+        {
+            Nes_SetPPUThread(sWin32_ThreadContext, true);
+        }
+    }
+
+    /* a few cores help with scaling, the window thread scales whatever they don't get to */
+    {
+        SYSTEM_INFO SystemInfo;
+        GetSystemInfo(&SystemInfo);
+        LONG WorkerCount = (LONG)SystemInfo.dwNumberOfProcessors - 1;
+        if (WorkerCount > WIN32_MAX_SCALER_WORKERS)
+            WorkerCount = WIN32_MAX_SCALER_WORKERS;
+        if (WorkerCount > 0)
+            sWin32_Scaler.WakeUp = CreateSemaphoreA(NULL, 0, WorkerCount, NULL);
+        for (LONG i = 0; sWin32_Scaler.WakeUp && i < WorkerCount; i++)
+        {
+            HANDLE Thread = CreateThread(NULL, 0, Win32_ScalerThread, NULL, 0, NULL);
+            if (NULL == Thread) /* not fatal, there's just less help */
+                break;
+            sWin32_Scaler.ThreadHandles[sWin32_Scaler.ThreadCount++] = Thread;
+        }
+    }
+
+    /* the emulator runs on its own thread, this one only handles the window */
+    sWin32_Emulation.ThreadShouldStop = false;
+    sWin32_Emulation.ThreadHandle = CreateThread(NULL, 0, Win32_EmulationThread, NULL, 0, NULL);
+    if (NULL == sWin32_Emulation.ThreadHandle)
+    {
+        Win32_Fatal("Unable to create the emulator thread.");
+    }
+
+
     /* event loop */
-    double TimeOrigin = Platform_GetTimeMillisec();
-    while (Win32_PollInputs())
+    MSG Msg;
+    while (GetMessageA(&Msg, NULL, 0, 0) > 0)
     {
-        double Now = Platform_GetTimeMillisec();
-        Nes_OnLoop(sWin32_ThreadContext, Now - TimeOrigin);
-        //Sleep(1);
+        TranslateMessage(&Msg);
+        DispatchMessageA(&Msg);
+    }
+
+    sWin32_Emulation.ThreadShouldStop = true;
+    WaitForSingleObject(sWin32_Emulation.ThreadHandle, INFINITE);
+    CloseHandle(sWin32_Emulation.ThreadHandle);
+    /* only after the emulator thread, which could be waiting on it */
+    if (sWin32_PPUThread.ThreadHandle)
+    {
+        sWin32_PPUThread.ThreadShouldStop = true;
+        WaitForSingleObject(sWin32_PPUThread.ThreadHandle, INFINITE);
+        CloseHandle(sWin32_PPUThread.ThreadHandle);
+    }
+    sWin32_Scaler.ThreadShouldStop = true;
+    for (LONG i = 0; i < sWin32_Scaler.ThreadCount; i++)
+    {
+        WaitForSingleObject(sWin32_Scaler.ThreadHandles[i], INFINITE);
+        CloseHandle(sWin32_Scaler.ThreadHandles[i]);
     }
 
 
@@ -952,3 +1162,25 @@ Nes_ControllerStatus Platform_GetControllerState(void)
     return ControllerStatus;
 }
 
+
+u32 Platform_AtomicExchange(volatile u32 *Dst, u32 Value)
+{
+    return (u32)InterlockedExchange((volatile LONG *)Dst, (LONG)Value);
+}
+
+u32 Platform_AtomicAdd(volatile u32 *Dst, u32 Value)
+{
+    return (u32)InterlockedExchangeAdd((volatile LONG *)Dst, (LONG)Value);
+}
+
+void Platform_OnScalerJob(void)
+{
+    if (sWin32_Scaler.ThreadCount)
+        ReleaseSemaphore(sWin32_Scaler.WakeUp, sWin32_Scaler.ThreadCount, NULL);
+}
+
+void Platform_OnScanlinesCompleted(Platform_FrameBuffer Band, u32 FirstScanline)
+{
+    /* scanline bands are never enabled, frames are presented whole in Win32_UpdateWindowTimer */
+    (void)Band, (void)FirstScanline;
+}